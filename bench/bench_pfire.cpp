@@ -0,0 +1,207 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <petscsys.h>
+
+#include "benchcase.hpp"
+#include "regression.hpp"
+#include "setup.hpp"
+#include "types.hpp"
+
+namespace bf = boost::filesystem;
+namespace po = boost::program_options;
+namespace pt = boost::property_tree;
+
+struct BenchOptions {
+  BenchCase bcase;
+  bool io;
+  std::string io_prefix;
+  std::string format;
+  std::string output;
+  std::string regression;
+  std::string update_baseline;
+};
+
+BenchOptions parse_arguments(int argc, char** argv)
+{
+  BenchOptions opts;
+  std::string shapestr;
+
+  po::options_description desc("bench_pfire options");
+  desc.add_options()("help,h", "print this message")(
+      "shape", po::value<std::string>(&shapestr)->default_value("128x128"),
+      "image shape, e.g 256x256 or 128x128x128")(
+      "nodespacing", po::value<integer>(&opts.bcase.nodespacing)->default_value(8),
+      "final map nodespacing")(
+      "amplitude", po::value<floating>(&opts.bcase.amplitude)->default_value(2.0),
+      "amplitude in pixels of the synthetic sinusoidal deformation")(
+      "weak", po::bool_switch(&opts.bcase.weak),
+      "treat shape as the per-rank size and grow the image with the number of ranks")(
+      "no-io", "skip writing the registered image and map")(
+      "io-prefix", po::value<std::string>(&opts.io_prefix)->default_value("bench"),
+      "filename prefix for output written during the io phase")(
+      "format", po::value<std::string>(&opts.format)->default_value("csv"),
+      "output format, csv or json (one object per line)")(
+      "output", po::value<std::string>(&opts.output)->default_value(""),
+      "file to append results to, default stdout")(
+      "regression", po::value<std::string>(&opts.regression)->default_value(""),
+      "run the regression cases and compare against this baseline file")(
+      "update-baseline", po::value<std::string>(&opts.update_baseline)->default_value(""),
+      "run the regression cases and write the results as a new baseline file");
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << desc << std::endl;
+    std::exit(0);
+  }
+  if (opts.format != "csv" && opts.format != "json")
+  {
+    throw std::runtime_error("format must be csv or json");
+  }
+
+  opts.io = !vm.count("no-io");
+  opts.bcase.name = "custom";
+  opts.bcase.shape = parse_shape(shapestr);
+  return opts;
+}
+
+void write_csv(std::ostream& out, const BenchResult& result, bool header)
+{
+  if (header)
+  {
+    out << "ranks,ndim,shape,nodespacing,phase,calls,seconds\n";
+  }
+  std::string prefix = std::to_string(result.ranks) + "," + std::to_string(result.ndim) + ","
+                       + shape_to_string(result.shape, result.ndim) + ","
+                       + std::to_string(result.nodespacing) + ",";
+  for (const auto& it : result.phases)
+  {
+    out << prefix << it.first << "," << it.second.calls << "," << it.second.seconds << "\n";
+  }
+  out << prefix << "total,1," << result.total_seconds << "\n";
+}
+
+void write_result(const BenchOptions& opts, const BenchResult& result)
+{
+  std::ofstream outfile;
+  bool header = true;
+  if (!opts.output.empty())
+  {
+    header = !bf::exists(opts.output) || bf::file_size(opts.output) == 0;
+    outfile.open(opts.output, std::ios::app);
+  }
+  std::ostream& out = opts.output.empty() ? std::cout : outfile;
+
+  if (opts.format == "csv")
+  {
+    write_csv(out, result, header);
+  }
+  else
+  {
+    pt::write_json(out, result_to_ptree(result), false);
+  }
+}
+
+int run_regression(const BenchOptions& opts, MPI_Comm comm)
+{
+  int rank;
+  MPI_Comm_rank(comm, &rank);
+
+  if (opts.update_baseline.empty())
+  {
+    int recorded = rank == 0 ? baseline_recorded(opts.regression) : 0;
+    MPI_Bcast(&recorded, 1, MPI_INT, 0, comm);
+    if (!recorded)
+    {
+      // A skip is easy to miss in a CI log, so there an unrecorded baseline is a failure
+      bool ci = std::getenv("CI") != nullptr;
+      PetscPrintf(comm, "WARNING: no results recorded in %s, the performance regression check "
+          "did not run. Run `make bench_update_baseline` on the reference machine and commit "
+          "the baseline.\n", opts.regression.c_str());
+      return ci ? 1 : regression_skipped;
+    }
+  }
+
+  std::vector<BenchResult> results;
+  for (const auto& bcase : regression_cases())
+  {
+    PetscPrintf(comm, "Running regression case %s\n", bcase.name.c_str());
+    results.push_back(run_case(bcase, "", comm));
+  }
+
+  int status = 0;
+  if (rank == 0)
+  {
+    if (!opts.update_baseline.empty())
+    {
+      // Keep any tolerances already tuned in the baseline being replaced
+      write_baseline(opts.update_baseline, results, read_tolerances(opts.update_baseline));
+      std::cout << "Baseline written to " << opts.update_baseline << std::endl;
+    }
+    else
+    {
+      std::ostringstream report;
+      report << "Performance regression check (baseline, current):\n";
+      status = check_baseline(opts.regression, results, report) ? 0 : 1;
+      std::cout << report.str() << std::flush;
+    }
+  }
+  MPI_Bcast(&status, 1, MPI_INT, 0, comm);
+  return status;
+}
+
+int main(int argc, char** argv)
+{
+  BenchOptions opts = parse_arguments(argc, argv);
+
+  pfire_setup(std::vector<std::string>());
+
+  int status = 0;
+  if (!opts.regression.empty() || !opts.update_baseline.empty())
+  {
+    status = run_regression(opts, PETSC_COMM_WORLD);
+  }
+  else
+  {
+    BenchResult result =
+        run_case(opts.bcase, opts.io ? opts.io_prefix : std::string(), PETSC_COMM_WORLD);
+
+    int rank;
+    MPI_Comm_rank(PETSC_COMM_WORLD, &rank);
+    if (rank == 0)
+    {
+      write_result(opts, result);
+    }
+  }
+
+  pfire_teardown();
+
+  return status;
+}
@@ -0,0 +1,139 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "benchcase.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+
+#include "basewriter.hpp"
+#include "dictconfiguration.hpp"
+#include "elastic.hpp"
+#include "image.hpp"
+#include "infix_iterator.hpp"
+#include "synthetic.hpp"
+
+namespace ba = boost::algorithm;
+
+namespace
+{
+intvector global_shape(const BenchCase& bcase, MPI_Comm comm)
+{
+  intvector shape = bcase.shape;
+  if (bcase.weak)
+  {
+    // Grow each dimension by a balanced factorization of the rank count so the work per rank
+    // stays roughly constant
+    int nranks;
+    MPI_Comm_size(comm, &nranks);
+    std::vector<int> dims(shape.size(), 0);
+    MPI_Dims_create(nranks, dims.size(), dims.data());
+    std::transform(shape.begin(), shape.end(), dims.begin(), shape.begin(),
+        [](integer s, int d) -> integer { return s * d; });
+  }
+  if (shape.size() == 2)
+  {
+    shape.push_back(1);
+  }
+  return shape;
+}
+} // anonymous namespace
+
+BenchResult run_case(const BenchCase& bcase, const std::string& io_prefix, MPI_Comm comm)
+{
+  BenchResult result;
+  MPI_Comm_size(comm, &result.ranks);
+  result.ndim = bcase.shape.size();
+  result.shape = global_shape(bcase, comm);
+  result.nodespacing = bcase.nodespacing;
+
+  // Memory is measured from this case's own starting point, the process high-water mark would
+  // carry over from earlier cases run in the same process
+  profiling::reset();
+  bool was_tracking = profiling::memory_tracking();
+  profiling::set_memory_tracking(true);
+  profiling::sample_memory("case_start");
+  double start_resident = profiling::memory().at("case_start").resident;
+  auto tstart = std::chrono::steady_clock::now();
+
+  std::unique_ptr<Image> fixed, moved;
+  {
+    profiling::ScopedPhase phase("generate");
+    fixed = synthetic_image(result.shape, sinusoidal_field(result.shape, bcase.amplitude), comm);
+    moved = synthetic_image(result.shape, nullptr, comm);
+  }
+  fixed->normalize();
+  moved->normalize();
+
+  DictConfig config({{"fixed", "synthetic"}, {"moved", "synthetic"},
+      {"nodespacing", std::to_string(bcase.nodespacing)}});
+  floatvector nodespacing(fixed->ndim(), bcase.nodespacing);
+
+  Elastic reg(*fixed, *moved, nodespacing, config);
+  reg.autoregister();
+
+  if (!io_prefix.empty())
+  {
+    profiling::ScopedPhase phase("io");
+    BaseWriter_unique wtr =
+        BaseWriter::get_writer_for_filename(io_prefix + "_registered.xdmf:/registered", comm);
+    wtr->write_image(*reg.registered());
+    wtr = BaseWriter::get_writer_for_filename(io_prefix + "_map.xdmf:/map", comm);
+    wtr->write_map(*reg.m_p_map);
+  }
+
+  auto tend = std::chrono::steady_clock::now();
+  std::chrono::duration<double> diff = tend - tstart;
+  result.total_seconds = diff.count();
+  MPI_Allreduce(MPI_IN_PLACE, &result.total_seconds, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+  profiling::sample_memory("case_end");
+  profiling::set_memory_tracking(was_tracking);
+  double peak_resident = start_resident;
+  for (const auto& it : profiling::generation_memory())
+  {
+    peak_resident = std::max(peak_resident, it.second.resident);
+  }
+  result.peak_memory_bytes = peak_resident - start_resident;
+  MPI_Allreduce(MPI_IN_PLACE, &result.peak_memory_bytes, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+  result.phases = profiling::gather_max(comm);
+  result.counters = profiling::gather_counters(comm);
+  return result;
+}
+
+intvector parse_shape(const std::string& shapestr)
+{
+  std::vector<std::string> parts;
+  ba::split(parts, shapestr, ba::is_any_of("x,"), ba::token_compress_on);
+  if (parts.size() < 2 || parts.size() > 3)
+  {
+    throw std::runtime_error("shape should be 2D or 3D, e.g 256x256 or 128x128x128");
+  }
+  intvector shape;
+  std::transform(parts.cbegin(), parts.cend(), std::back_inserter(shape),
+      [](const std::string& s) -> integer { return std::stoll(s); });
+  return shape;
+}
+
+std::string shape_to_string(const intvector& shape, uinteger ndim)
+{
+  std::ostringstream shapess;
+  std::copy_n(shape.cbegin(), ndim, infix_ostream_iterator<integer>(shapess, "x"));
+  return shapess.str();
+}
@@ -0,0 +1,52 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#ifndef BENCHCASE_HPP
+#define BENCHCASE_HPP
+
+#include <string>
+
+#include <mpi.h>
+
+#include "profiling.hpp"
+#include "types.hpp"
+
+struct BenchCase {
+  std::string name;
+  intvector shape;
+  integer nodespacing;
+  floating amplitude = 2.0;
+  bool weak = false;
+};
+
+struct BenchResult {
+  int ranks;
+  uinteger ndim;
+  intvector shape;
+  integer nodespacing;
+  double total_seconds;
+  // Largest growth in resident memory over the start of the case, sampled at phase boundaries
+  double peak_memory_bytes;
+  profiling::phase_map phases;
+  profiling::counter_map counters;
+};
+
+// Register a synthetic pair for the case, if io_prefix is non-empty also write the results
+BenchResult run_case(const BenchCase& bcase, const std::string& io_prefix, MPI_Comm comm);
+
+intvector parse_shape(const std::string& shapestr);
+std::string shape_to_string(const intvector& shape, uinteger ndim);
+
+#endif // BENCHCASE_HPP
@@ -0,0 +1,187 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "regression.hpp"
+
+#include <iomanip>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+namespace bf = boost::filesystem;
+namespace pt = boost::property_tree;
+
+namespace
+{
+// Small enough to run under ctest, but covering both 2D and 3D and several generations
+const std::vector<BenchCase> cases = {
+    {"2d_256_ns8", {256, 256}, 8},
+    {"2d_512_ns16", {512, 512}, 16},
+    {"3d_64_ns8", {64, 64, 64}, 8},
+};
+
+bool check_value(std::ostream& report, const std::string& label, double current, double baseline,
+    double limit)
+{
+  bool ok = current <= limit;
+  report << "  " << std::left << std::setw(32) << label << std::right << std::setw(14)
+         << baseline << std::setw(14) << current << "  " << (ok ? "ok" : "REGRESSION") << "\n";
+  return ok;
+}
+
+std::string case_name(const BenchResult& result)
+{
+  for (const auto& bcase : cases)
+  {
+    if (shape_to_string(bcase.shape, bcase.shape.size())
+            == shape_to_string(result.shape, result.ndim)
+        && bcase.nodespacing == result.nodespacing)
+    {
+      return bcase.name;
+    }
+  }
+  throw std::runtime_error("result does not match any regression case");
+}
+} // anonymous namespace
+
+const std::vector<BenchCase>& regression_cases()
+{
+  return cases;
+}
+
+Tolerances read_tolerances(const std::string& path)
+{
+  Tolerances tols;
+  if (!bf::exists(path))
+  {
+    return tols;
+  }
+  pt::ptree tree;
+  pt::read_json(path, tree);
+  tols.time = tree.get("tolerances.time", tols.time);
+  tols.memory = tree.get("tolerances.memory", tols.memory);
+  tols.counters = tree.get("tolerances.counters", tols.counters);
+  tols.min_seconds = tree.get("tolerances.min_seconds", tols.min_seconds);
+  tols.min_memory_bytes = tree.get("tolerances.min_memory_bytes", tols.min_memory_bytes);
+  return tols;
+}
+
+pt::ptree result_to_ptree(const BenchResult& result)
+{
+  pt::ptree tree;
+  tree.put("ranks", result.ranks);
+  tree.put("ndim", result.ndim);
+  tree.put("shape", shape_to_string(result.shape, result.ndim));
+  tree.put("nodespacing", result.nodespacing);
+  tree.put("total_seconds", result.total_seconds);
+  tree.put("peak_memory_bytes", result.peak_memory_bytes);
+  // phase and counter names are plain identifiers so are safe to use as ptree paths
+  for (const auto& it : result.phases)
+  {
+    tree.put("phases." + it.first + ".calls", it.second.calls);
+    tree.put("phases." + it.first + ".seconds", it.second.seconds);
+  }
+  for (const auto& it : result.counters)
+  {
+    tree.put("counters." + it.first, it.second);
+  }
+  return tree;
+}
+
+void write_baseline(
+    const std::string& path, const std::vector<BenchResult>& results, const Tolerances& tols)
+{
+  pt::ptree tree;
+  tree.put("tolerances.time", tols.time);
+  tree.put("tolerances.memory", tols.memory);
+  tree.put("tolerances.counters", tols.counters);
+  tree.put("tolerances.min_seconds", tols.min_seconds);
+  tree.put("tolerances.min_memory_bytes", tols.min_memory_bytes);
+  for (const auto& result : results)
+  {
+    tree.add_child("cases." + case_name(result), result_to_ptree(result));
+  }
+  pt::write_json(path, tree);
+}
+
+bool baseline_recorded(const std::string& path)
+{
+  pt::ptree tree;
+  pt::read_json(path, tree);
+  auto recorded = tree.get_child_optional("cases");
+  return recorded && !recorded->empty();
+}
+
+bool check_baseline(
+    const std::string& path, const std::vector<BenchResult>& results, std::ostream& report)
+{
+  pt::ptree tree;
+  pt::read_json(path, tree);
+  Tolerances tols = read_tolerances(path);
+
+  bool all_ok = true;
+  for (const auto& result : results)
+  {
+    std::string name = case_name(result);
+    report << "Case " << name << ":\n";
+    auto base_it = tree.get_child_optional("cases." + name);
+    if (!base_it)
+    {
+      report << "  no baseline recorded for this case\n";
+      all_ok = false;
+      continue;
+    }
+    const pt::ptree& base = *base_it;
+    if (base.get<int>("ranks") != result.ranks)
+    {
+      report << "  baseline was recorded on " << base.get<int>("ranks") << " ranks, not "
+             << result.ranks << "\n";
+      all_ok = false;
+      continue;
+    }
+
+    double base_total = base.get<double>("total_seconds");
+    all_ok &= check_value(report, "total seconds", result.total_seconds, base_total,
+        base_total * (1 + tols.time));
+
+    for (const auto& it : result.phases)
+    {
+      double base_secs = base.get("phases." + it.first + ".seconds", -1.0);
+      if (base_secs < tols.min_seconds)
+      {
+        continue;
+      }
+      all_ok &= check_value(report, it.first + " seconds", it.second.seconds, base_secs,
+          base_secs * (1 + tols.time));
+    }
+
+    for (const auto& it : result.counters)
+    {
+      double base_count = base.get("counters." + it.first, -1.0);
+      if (base_count < 0)
+      {
+        continue;
+      }
+      all_ok &= check_value(report, it.first, it.second, base_count,
+          base_count * (1 + tols.counters) + 1);
+    }
+
+    double base_mem = base.get<double>("peak_memory_bytes");
+    all_ok &= check_value(report, "peak memory bytes", result.peak_memory_bytes, base_mem,
+        base_mem * (1 + tols.memory) + tols.min_memory_bytes);
+  }
+
+  return all_ok;
+}
@@ -0,0 +1,60 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#ifndef REGRESSION_HPP
+#define REGRESSION_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include "benchcase.hpp"
+
+// Allowed slowdown relative to the baseline, times and memory are fractional increases, counters
+// are a fractional increase plus one.  Phases faster than min_seconds are too noisy to check, and
+// memory is allowed min_memory_bytes of absolute slack for allocator noise on small cases.
+struct Tolerances {
+  double time = 0.25;
+  double memory = 0.15;
+  double counters = 0.10;
+  double min_seconds = 0.05;
+  double min_memory_bytes = 8 * 1024 * 1024;
+};
+
+// ctest reports the check as skipped, rather than passed or failed, with this exit code
+constexpr int regression_skipped = 77;
+
+const std::vector<BenchCase>& regression_cases();
+
+// Tolerances stored in the baseline file, the defaults for any that are missing or if the file
+// does not exist yet
+Tolerances read_tolerances(const std::string& path);
+
+boost::property_tree::ptree result_to_ptree(const BenchResult& result);
+
+void write_baseline(
+    const std::string& path, const std::vector<BenchResult>& results, const Tolerances& tols);
+
+// True if the baseline file has results recorded, a freshly committed baseline holds only the
+// tolerances until it is regenerated on the reference machine
+bool baseline_recorded(const std::string& path);
+
+// Returns true if all cases are within tolerance of the baseline, details are written to report
+bool check_baseline(
+    const std::string& path, const std::vector<BenchResult>& results, std::ostream& report);
+
+#endif // REGRESSION_HPP
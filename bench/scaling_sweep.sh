@@ -0,0 +1,51 @@
+#!/bin/bash
+#
+#   Copyright 2019 University of Sheffield
+#
+#   Licensed under the Apache License, Version 2.0 (the "License");
+#   you may not use this file except in compliance with the License.
+#   You may obtain a copy of the License at
+#
+#       http:#www.apache.org/licenses/LICENSE-2.0
+#
+#   Unless required by applicable law or agreed to in writing, software
+#   distributed under the License is distributed on an "AS IS" BASIS,
+#   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#   See the License for the specific language governing permissions and
+#   limitations under the License.
+
+# Usage: scaling_sweep.sh <strong|weak> <bench_pfire> <mpiexec> <numproc flag> "<ranks>" <output>
+#
+# Strong scaling runs each shape at every rank count, weak scaling treats each shape as the per-rank
+# size.  Set BENCH_SHAPES to override the default list of shapes and BENCH_FORMAT=json for json
+# output.
+
+set -e
+
+mode=$1
+bench=$2
+mpiexec=$3
+npflag=$4
+ranks=$5
+output=$6
+
+if [ "$mode" == "strong" ]; then
+  shapes=${BENCH_SHAPES:-"64x64 256x256 1024x1024 64x64x64 128x128x128 256x256x256 512x512x512"}
+  extra=""
+elif [ "$mode" == "weak" ]; then
+  shapes=${BENCH_SHAPES:-"64x64 512x512 64x64x64 128x128x128"}
+  extra="--weak"
+else
+  echo "Unknown mode \"$mode\", expected strong or weak" >&2
+  exit 1
+fi
+
+for shape in $shapes; do
+  for np in $ranks; do
+    echo "Running $mode scaling: shape $shape on $np ranks"
+    "$mpiexec" $npflag $np "$bench" --shape $shape $extra --format ${BENCH_FORMAT:-csv} \
+      --output "$output" --io-prefix "bench_${mode}_${shape}_${np}" > /dev/null
+  done
+done
+
+echo "Results written to $output"
@@ -15,6 +15,8 @@
 
 #include "baseconfiguration.hpp"
 
+#include <algorithm>
+#include <cctype>
 #include <sstream>
 
 #include "infix_iterator.hpp"
@@ -23,15 +25,40 @@ const config_map ConfigurationBase::default_config = {{"verbose", "false"},
                                                       {"registered", "registered.xdmf:/registered"},
                                                       {"map", "map.xdmf:/map"},
                                                       {"debug_frames", "false"},
-                                                      {"debug_frames_prefix", "debug"}};
+                                                      {"debug_frames_prefix", "debug"},
+                                                      {"profile", "false"},
+                                                      {"profile_memory", "false"},
+                                                      {"debug_balance", "false"},
+                                                      {"decomposition", "petsc"},
+                                                      {"process_grid", ""},
+                                                      {"ownership_x", ""},
+                                                      {"ownership_y", ""},
+                                                      {"ownership_z", ""},
+                                                      {"map_update", "additive"},
+                                                      {"basis_type", "linear"},
+                                                      {"warp_interpolation", "linear"},
+                                                      {"symmetric_scaling", "false"},
+                                                      {"fieldsplit", "none"},
+                                                      {"solver", "normal"},
+                                                      {"line_search", "false"},
+                                                      {"inexact_newton", "false"},
+                                                      {"direct_solve_size", "5000"},
+                                                      {"autotune", "false"},
+                                                      {"krylov_recycle", "0"},
+                                                      {"operator_lag", "1"}};
 
 const std::vector<std::string> ConfigurationBase::required_options = {"fixed", "moved",
                                                                       "nodespacing"};
 
 const std::vector<std::string> ConfigurationBase::arg_options = {
-    "fixed", "moved", "mask", "nodespacing", "registered", "map", "debug_frames_prefix"};
+    "fixed", "moved", "mask", "nodespacing", "registered", "map", "debug_frames_prefix",
+    "decomposition", "process_grid", "ownership_x", "ownership_y", "ownership_z",
+    "map_update", "basis_type", "warp_interpolation", "fieldsplit", "solver", "direct_solve_size",
+    "krylov_recycle", "operator_lag"};
 
-const std::vector<std::string> ConfigurationBase::bool_options = {"verbose", "debug_frames"};
+const std::vector<std::string> ConfigurationBase::bool_options = {
+    "verbose", "debug_frames", "debug_balance", "profile", "profile_memory", "symmetric_scaling",
+    "line_search", "inexact_newton", "autotune"};
 
 ConfigurationBase::ConfigurationBase(const int &argc, char const *const *argv)
   : config(default_config), arguments(argv + 1, argv + argc),
@@ -39,6 +66,11 @@ ConfigurationBase::ConfigurationBase(const int &argc, char const *const *argv)
 {
 }
 
+ConfigurationBase::ConfigurationBase(const std::string &invocation)
+  : config(default_config), arguments(), invocation_name(invocation)
+{
+}
+
 void ConfigurationBase::validate_config()
 {
   std::list<std::string> missing;
@@ -59,6 +91,41 @@ void ConfigurationBase::validate_config()
   }
 }
 
+std::string ConfigurationBase::generation_prefix(integer generation)
+{
+  return "gen" + std::to_string(generation) + "_";
+}
+
+bool ConfigurationBase::add_petsc_option(
+    const std::string &section, const std::string &key, const std::string &value)
+{
+  // "petsc" holds global options, "petsc.genN" options for generation N only
+  std::string prefix;
+  const std::string gen_section = "petsc.gen";
+  if (section.compare(0, gen_section.size(), gen_section) == 0)
+  {
+    std::string number = section.substr(gen_section.size());
+    if (number.empty() || !std::all_of(number.cbegin(), number.cend(),
+                              [](unsigned char c) -> bool { return std::isdigit(c); }))
+    {
+      return false;
+    }
+    prefix = generation_prefix(std::stoll(number));
+  }
+  else if (section != "petsc")
+  {
+    return false;
+  }
+
+  size_t name_start = key.find_first_not_of('-');
+  if (name_start == std::string::npos)
+  {
+    return false;
+  }
+  petsc_config["-" + prefix + key.substr(name_start)] = value;
+  return true;
+}
+
 std::string ConfigurationBase::get_invocation_name(const std::string &argzero)
 {
   bf::path invpath(argzero);
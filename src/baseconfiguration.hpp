@@ -61,10 +61,24 @@ public:
 
   void validate_config();
 
+  // PETSc options given in the configuration, keyed by option name. Options for a single
+  // generation carry its prefix, e.g. "-gen2_ksp_type".
+  const config_map& petsc_options() const
+  {
+    return petsc_config;
+  }
+
+  static std::string generation_prefix(integer generation);
+
 protected:
   ConfigurationBase(const int& argc, char const* const* argv);
+  explicit ConfigurationBase(const std::string& invocation);
+
+  bool add_petsc_option(
+      const std::string& section, const std::string& key, const std::string& value);
 
   config_map config;
+  config_map petsc_config;
   std::vector<std::string> arguments;
   std::string invocation_name;
 
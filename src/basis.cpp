@@ -15,6 +15,7 @@
 
 #include "basis.hpp"
 
+#include <petscdmda.h>
 #include <petscmat.h>
 
 #include "debug.hpp"
@@ -22,10 +23,273 @@
 #include "indexing.hpp"
 #include "iterator_routines.hpp"
 
+namespace
+{
+using weightlist = std::vector<std::pair<integer, floating>>;
+
+// Append weight w for node idx on a grid of n nodes. Out of range nodes are either dropped or
+// folded onto the edge node, so that the weights still sum to one. Indices arrive in increasing
+// order so folded duplicates are adjacent.
+void add_weight(weightlist& weights, integer idx, floating w, integer n, bool fold)
+{
+  if (!fold && (idx < 0 || idx >= n))
+  {
+    return;
+  }
+  idx = std::min(std::max(idx, integer(0)), n - 1);
+  if (!weights.empty() && weights.back().first == idx)
+  {
+    weights.back().second += w;
+  }
+  else
+  {
+    weights.emplace_back(idx, w);
+  }
+}
+
+// Reflect idx about the first and last nodes (whole-sample symmetric extension), as often as
+// needed for grids shorter than the stencil
+integer mirror_index(integer idx, integer n)
+{
+  if (n == 1)
+  {
+    return 0;
+  }
+  integer period = 2 * (n - 1);
+  idx = ((idx % period) + period) % period;
+  return (idx < n) ? idx : period - idx;
+}
+
+// Append weight w for node idx reflected into the grid. Reflected indices are no longer in order,
+// so merge into the sorted list.
+void add_mirrored_weight(weightlist& weights, integer idx, floating w, integer n)
+{
+  idx = mirror_index(idx, n);
+  auto it = std::lower_bound(weights.begin(), weights.end(), idx,
+      [](const std::pair<integer, floating>& a, integer b) -> bool { return a.first < b; });
+  if (it != weights.end() && it->first == idx)
+  {
+    it->second += w;
+  }
+  else
+  {
+    weights.emplace(it, idx, w);
+  }
+}
+
+void drop_zero_weights(weightlist& weights)
+{
+  weights.erase(
+      std::remove_if(weights.begin(), weights.end(),
+          [](const std::pair<integer, floating>& w) -> bool { return w.second == 0; }),
+      weights.end());
+}
+
+// The map basis folds out of range nodes onto the edge. Image coefficients are mirrored
+// instead, the boundary condition under which the separable prefilter is exact.
+void add_cubic_bspline_weights(
+    weightlist& weights, integer floor, floating t, integer n, bool mirror = false)
+{
+  floating t2 = t * t;
+  floating t3 = t2 * t;
+  floatvector w = {(1 - t) * (1 - t) * (1 - t) / 6, (3 * t3 - 6 * t2 + 4) / 6,
+      (-3 * t3 + 3 * t2 + 3 * t + 1) / 6, t3 / 6};
+  for (integer ioff = -1; ioff <= 2; ioff++)
+  {
+    if (mirror)
+    {
+      add_mirrored_weight(weights, floor + ioff, w[ioff + 1], n);
+    }
+    else
+    {
+      add_weight(weights, floor + ioff, w[ioff + 1], n, true);
+    }
+  }
+}
+
+floating sinc(floating x)
+{
+  return (x == 0) ? 1 : std::sin(M_PI * x) / (M_PI * x);
+}
+
+// Nonzero weights along one dimension for source coordinate x on a grid of n nodes.
+weightlist basis_weights_1d(floating x, integer n, BasisType basis_type, bool dyadic_refinement)
+{
+  weightlist weights;
+  integer floor = static_cast<integer>(std::floor(x));
+  floating t = x - floor;
+  if (basis_type == BasisType::linear)
+  {
+    add_weight(weights, floor, 1 - t, n, false);
+    add_weight(weights, floor + 1, t, n, false);
+  }
+  else if (dyadic_refinement)
+  {
+    // Fine nodes coincide with coarse nodes (weights 1/8, 6/8, 1/8) or fall midway between two
+    // (weights 1/2, 1/2)
+    if (t < 0.25 || t > 0.75)
+    {
+      integer centre = static_cast<integer>(std::round(x));
+      add_weight(weights, centre - 1, 0.125, n, true);
+      add_weight(weights, centre, 0.75, n, true);
+      add_weight(weights, centre + 1, 0.125, n, true);
+    }
+    else
+    {
+      add_weight(weights, floor, 0.5, n, true);
+      add_weight(weights, floor + 1, 0.5, n, true);
+    }
+  }
+  else
+  {
+    add_cubic_bspline_weights(weights, floor, t, n);
+  }
+  drop_zero_weights(weights);
+  return weights;
+}
+
+// Image interpolation weights along one dimension for source coordinate x on n pixels, weights
+// is reused between calls so the per-pixel loops do not allocate
+void warp_weights_1d(floating x, integer n, WarpInterpolation interpolation, weightlist& weights)
+{
+  weights.clear();
+  if (interpolation == WarpInterpolation::linear)
+  {
+    // Need to clamp locations to the edges of the image
+    x = clamp_to_edge(x, n);
+    integer floor = static_cast<integer>(std::floor(x));
+    floating t = x - floor;
+    add_weight(weights, floor, 1 - t, n, false);
+    add_weight(weights, floor + 1, t, n, false);
+  }
+  else
+  {
+    x = std::min(std::max(x, floating(0)), floating(n - 1));
+    integer floor = static_cast<integer>(std::floor(x));
+    floating t = x - floor;
+    if (interpolation == WarpInterpolation::cubic)
+    {
+      add_cubic_bspline_weights(weights, floor, t, n, true);
+    }
+    else
+    {
+      // Lanczos-2 windowed sinc, renormalised so a constant image is preserved
+      floating lanczos[4];
+      for (integer ioff = -1; ioff <= 2; ioff++)
+      {
+        floating d = t - ioff;
+        lanczos[ioff + 1] = sinc(d) * sinc(d / 2);
+      }
+      floating total = std::accumulate(lanczos, lanczos + 4, floating(0));
+      for (integer ioff = -1; ioff <= 2; ioff++)
+      {
+        add_weight(weights, floor + ioff, lanczos[ioff + 1] / total, n, true);
+      }
+    }
+  }
+  drop_zero_weights(weights);
+}
+
+weightlist warp_weights_1d(floating x, integer n, WarpInterpolation interpolation)
+{
+  weightlist weights;
+  warp_weights_1d(x, n, interpolation, weights);
+  return weights;
+}
+
+// Owned and ghosted boxes of a DMDA with the global grid shape, unused dimensions have extent 1
+struct GhostedBox {
+  intvector shape = intvector(3, 1);
+  intvector lo = intvector(3, 0);
+  intvector width = intvector(3, 1);
+  intvector glo = intvector(3, 0);
+  intvector gwidth = intvector(3, 1);
+
+  GhostedBox(MPI_Comm comm, const DM& dmda)
+  {
+    PetscErrorCode perr = DMDAGetInfo(dmda, nullptr, &shape[0], &shape[1], &shape[2], nullptr,
+        nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr);
+    CHKERRABORT(comm, perr);
+    perr = DMDAGetCorners(dmda, &lo[0], &lo[1], &lo[2], &width[0], &width[1], &width[2]);
+    CHKERRABORT(comm, perr);
+    perr = DMDAGetGhostCorners(
+        dmda, &glo[0], &glo[1], &glo[2], &gwidth[0], &gwidth[1], &gwidth[2]);
+    CHKERRABORT(comm, perr);
+  }
+
+  // Offset in the ghosted local array of global grid point (i, j, k)
+  integer local_offset(integer i, integer j, integer k) const
+  {
+    return ((k - glo[2]) * gwidth[1] + (j - glo[1])) * gwidth[0] + (i - glo[0]);
+  }
+
+  bool in_ghosts(uinteger dim, const weightlist& weights) const
+  {
+    return weights.front().first >= glo[dim]
+           && weights.back().first < glo[dim] + gwidth[dim];
+  }
+};
+
+// Append one CSR row holding the tensor product of the 1D weights, dim 0 varying fastest
+void append_tensor_product_row(
+    const std::vector<weightlist>& weights, const intvector& src_shape, integer col_ofs,
+    intvector& idxm, floatvector& mdat, integer& rowptr)
+{
+  uinteger ndim = weights.size();
+  if (std::any_of(weights.cbegin(), weights.cend(),
+                  [](const weightlist& w) -> bool { return w.empty(); }))
+  {
+    return;
+  }
+  intvector counter(ndim, 0);
+  intvector src_idx(ndim, 0);
+  while (true)
+  {
+    floating coeff = 1;
+    for (uinteger idim = 0; idim < ndim; idim++)
+    {
+      src_idx[idim] = weights[idim][counter[idim]].first;
+      coeff *= weights[idim][counter[idim]].second;
+    }
+    rowptr++;
+    idxm.push_back(ravel(src_idx, src_shape) + col_ofs);
+    mdat.push_back(coeff);
+
+    uinteger idim = 0;
+    for (; idim < ndim; idim++)
+    {
+      if (++counter[idim] < static_cast<integer>(weights[idim].size()))
+      {
+        break;
+      }
+      counter[idim] = 0;
+    }
+    if (idim == ndim)
+    {
+      return;
+    }
+  }
+}
+} // anonymous namespace
+
+BasisType basis_type_from_string(const std::string& name)
+{
+  if (name == "linear")
+  {
+    return BasisType::linear;
+  }
+  if (name == "cubic")
+  {
+    return BasisType::cubic;
+  }
+  throw std::runtime_error("basis_type must be one of linear, cubic");
+}
+
 // scalings are src_spacing/tgt_spacing for each dim, offsets are tgt[0,0,0] - src[0,0,0]
 Mat_unique build_basis_matrix(
     MPI_Comm comm, const intvector& src_shape, const intvector& tgt_shape,
-    const floatvector& scalings, const floatvector& offsets, uinteger ndim, uinteger tile_dim)
+    const floatvector& scalings, const floatvector& offsets, uinteger ndim, uinteger tile_dim,
+    BasisType basis_type, bool dyadic_refinement)
 {
   intvector src_shape_trunc(ndim, 0);
   std::copy_n(src_shape.begin(), ndim, src_shape_trunc.begin());
@@ -64,61 +328,20 @@ Mat_unique build_basis_matrix(
   integer rowptr = 0;
   idxn.push_back(rowptr);
 
-  integer npoints = 1;
-  for (uinteger idim = 0; idim < ndim; idim++)
-  {
-    npoints *= 2;
-  }
-
+  std::vector<weightlist> weights(ndim);
   for (integer gidx = startrow; gidx < endrow; gidx++)
   {
     integer idx = gidx % tgt_size;
     integer col_ofs = src_size * (gidx / tgt_size);
-    // unravel tgt loc and find equivalent source loc
+    // unravel tgt loc and find the 1D weights for the equivalent source loc in each dimension
     intvector tgt_coord = unravel(idx, tgt_shape_trunc);
-    floatvector src_coord(ndim, 0.);
-    intvector src_coord_floor(ndim, 0);
-    // need both exact loc and floored loc
-    n_ary_transform(
-        [](floating x, floating a, floating b) -> floating { return a * x + b; },
-        src_coord.begin(), tgt_coord.begin(), tgt_coord.end(), scalings.begin(), offsets.begin());
-    std::transform(
-        src_coord.begin(), src_coord.end(), src_coord_floor.begin(),
-        [](floating x) -> integer { return static_cast<integer>(std::floor(x)); });
-
-    for (integer ipoint = 0; ipoint < npoints; ipoint++)
+    for (uinteger idim = 0; idim < ndim; idim++)
     {
-      for (uinteger idim = 0; idim < ndim; idim++)
-      {
-        if ((1 << idim) & ipoint)
-        {
-          src_coord_floor[idim] += 1;
-        }
-      }
-      if (all_true_varlen(
-              src_coord_floor.begin(), src_coord_floor.end(), src_shape_trunc.begin(),
-              src_shape_trunc.end(), std::less<>())
-          && std::all_of(src_coord_floor.begin(), src_coord_floor.end(), [](floating a) -> bool {
-               return a >= 0;
-             }))
-      {
-        floating coeff = calculate_basis_coefficient(
-            src_coord.begin(), src_coord.end(), src_coord_floor.begin());
-        if (coeff > 0)
-        {
-          rowptr++;
-          idxm.push_back(ravel(src_coord_floor, src_shape_trunc) + col_ofs);
-          mdat.push_back(coeff);
-        }
-      }
-      for (uinteger idim = 0; idim < ndim; idim++)
-      {
-        if ((1 << idim) & ipoint)
-        {
-          src_coord_floor[idim] -= 1;
-        }
-      }
+      floating src_coord = scalings[idim] * tgt_coord[idim] + offsets[idim];
+      weights[idim] =
+          basis_weights_1d(src_coord, src_shape_trunc[idim], basis_type, dyadic_refinement);
     }
+    append_tensor_product_row(weights, src_shape_trunc, col_ofs, idxm, mdat, rowptr);
     idxn.push_back(rowptr);
   }
   Mat_unique m_basis = create_unique_mat();
@@ -134,9 +357,75 @@ Mat_unique build_basis_matrix(
   return m_basis;
 }
 
+Mat_unique build_image_basis_matrix(
+    MPI_Comm comm, const DM& dmda, const intvector& src_shape, const floatvector& scalings,
+    const floatvector& offsets, uinteger ndim, BasisType basis_type)
+{
+  intvector src_shape_trunc(ndim, 0);
+  std::copy_n(src_shape.begin(), ndim, src_shape_trunc.begin());
+  integer src_size =
+      std::accumulate(src_shape_trunc.begin(), src_shape_trunc.end(), 1, std::multiplies<>());
+
+  // Rows are the locally owned pixels in PETSc ordering, as for the warp matrix, so the result
+  // lines up with the image vectors without any scatter
+  intvector lo(3, 0), width(3, 0);
+  PetscErrorCode perr =
+      DMDAGetCorners(dmda, &lo[0], &lo[1], &lo[2], &width[0], &width[1], &width[2]);
+  CHKERRABORT(comm, perr);
+  integer localsize = width[0] * width[1] * width[2];
+  intvector width_trunc(ndim, 0);
+  std::copy_n(width.begin(), ndim, width_trunc.begin());
+
+  // construct CSR format directly
+  intvector idxn, idxm;
+  floatvector mdat;
+  integer rowptr = 0;
+  idxn.push_back(rowptr);
+
+  std::vector<weightlist> weights(ndim);
+  for (integer locidx = 0; locidx < localsize; locidx++)
+  {
+    intvector tgt_coord = unravel(locidx, width_trunc);
+    for (uinteger idim = 0; idim < ndim; idim++)
+    {
+      floating src_coord = scalings[idim] * (tgt_coord[idim] + lo[idim]) + offsets[idim];
+      weights[idim] = basis_weights_1d(src_coord, src_shape_trunc[idim], basis_type, false);
+    }
+    append_tensor_product_row(weights, src_shape_trunc, 0, idxm, mdat, rowptr);
+    idxn.push_back(rowptr);
+  }
+  Mat_unique basis = create_unique_mat();
+  perr = MatCreateMPIAIJWithArrays(comm, localsize, PETSC_DECIDE, PETSC_DETERMINE, src_size,
+      idxn.data(), idxm.data(), mdat.data(), basis.get());
+  CHKERRABORT(comm, perr);
+
+#ifdef DEBUG_VERBOSE
+  matrix_dbg_print(comm, *basis, "Image Basis Matrix");
+#endif // DEBUG_VERBOSE
+
+  return basis;
+}
+
+WarpInterpolation warp_interpolation_from_string(const std::string& name)
+{
+  if (name == "linear")
+  {
+    return WarpInterpolation::linear;
+  }
+  if (name == "cubic")
+  {
+    return WarpInterpolation::cubic;
+  }
+  if (name == "sinc")
+  {
+    return WarpInterpolation::sinc;
+  }
+  throw std::runtime_error("warp_interpolation must be one of linear, cubic, sinc");
+}
+
 Mat_unique build_warp_matrix(
-    MPI_Comm comm, const intvector& img_shape, uinteger ndim,
-    const std::vector<Vec*>& displacements)
+    MPI_Comm comm, const DM& dmda, const intvector& img_shape, uinteger ndim,
+    const std::vector<Vec*>& displacements, WarpInterpolation interpolation)
 {
   // get total nodes per dim, and tot_rows = tgt_size*ndim
   integer mat_size = std::accumulate(img_shape.begin(), img_shape.end(), 1, std::multiplies<>());
@@ -153,9 +442,15 @@ Mat_unique build_warp_matrix(
   intvector img_shape_trunc(ndim, 0);
   std::copy_n(img_shape.begin(), ndim, img_shape_trunc.begin());
 
-  // TODO: should really be asserting all displacement vectors are the right shape and layout
-  integer startrow, endrow;
-  PetscErrorCode perr = VecGetOwnershipRange(*displacements[0], &startrow, &endrow);
+  // Rows are the locally owned pixels in PETSc ordering, i.e the DMDA local block with i fastest,
+  // which is also the order of the owned part of the displacement vectors
+  intvector lo(3, 0), width(3, 0);
+  PetscErrorCode perr =
+      DMDAGetCorners(dmda, &lo[0], &lo[1], &lo[2], &width[0], &width[1], &width[2]);
+  CHKERRABORT(comm, perr);
+  integer localsize = width[0] * width[1] * width[2];
+  intvector width_trunc(ndim, 0);
+  std::copy_n(width.begin(), ndim, width_trunc.begin());
 
   // construct CSR format directly
   intvector idxn, idxm;
@@ -163,12 +458,6 @@ Mat_unique build_warp_matrix(
   integer rowptr = 0;
   idxn.push_back(rowptr);
 
-  integer npoints = 1;
-  for (uinteger idim = 0; idim < ndim; idim++)
-  {
-    npoints *= 2;
-  }
-
   std::vector<floating*> raw_arrs(ndim, nullptr);
   // lambda needed here anyway to capture comm
   auto get_raw_array = [comm](floating*& a, const Vec* v) -> void {
@@ -177,60 +466,17 @@ Mat_unique build_warp_matrix(
   };
   n_ary_for_each(get_raw_array, raw_arrs.begin(), raw_arrs.end(), displacements.begin());
 
-  for (integer idx = startrow; idx < endrow; idx++)
+  std::vector<weightlist> weights(ndim);
+  for (integer locidx = 0; locidx < localsize; locidx++)
   {
-    // unravel tgt loc and find equivalent source loc
-    integer locidx = idx - startrow;
-    intvector tgt_coord = unravel(idx, img_shape_trunc);
-    floatvector src_coord(ndim, 0.);
-    intvector src_coord_floor(ndim, 0);
-
-    // offset src_coord
-    std::transform(
-        tgt_coord.begin(), tgt_coord.end(), raw_arrs.begin(), src_coord.begin(),
-        [locidx](floating x, floating* arr) -> floating { return x + arr[locidx]; });
-    // Need to clamp locations to the edges of the image
-    std::transform(
-        src_coord.begin(), src_coord.end(), img_shape_trunc.begin(), src_coord.begin(),
-        clamp_to_edge);
-    // Floor to get nearest pixel
-    std::transform(
-        src_coord.begin(), src_coord.end(), src_coord_floor.begin(),
-        [](floating x) -> integer { return static_cast<integer>(std::floor(x)); });
-
-    for (integer ipoint = 0; ipoint < npoints; ipoint++)
+    // unravel tgt loc within local block and find the 1D weights for the displaced source loc
+    intvector tgt_coord = unravel(locidx, width_trunc);
+    for (uinteger idim = 0; idim < ndim; idim++)
     {
-      for (uinteger idim = 0; idim < ndim; idim++)
-      {
-        if ((1 << idim) & ipoint)
-        {
-          src_coord_floor[idim] += 1;
-        }
-      }
-      if (all_true_varlen(
-              src_coord_floor.begin(), src_coord_floor.end(), img_shape_trunc.begin(),
-              img_shape_trunc.end(), std::less<>())
-          && std::all_of(src_coord_floor.begin(), src_coord_floor.end(), [](floating a) -> bool {
-               return a >= 0;
-             }))
-      {
-        floating coeff = calculate_basis_coefficient(
-            src_coord.begin(), src_coord.end(), src_coord_floor.begin());
-        if (coeff > 0)
-        {
-          rowptr++;
-          idxm.push_back(ravel(src_coord_floor, img_shape_trunc));
-          mdat.push_back(coeff);
-        }
-      }
-      for (uinteger idim = 0; idim < ndim; idim++)
-      {
-        if ((1 << idim) & ipoint)
-        {
-          src_coord_floor[idim] -= 1;
-        }
-      }
+      floating src_coord = tgt_coord[idim] + lo[idim] + raw_arrs[idim][locidx];
+      weights[idim] = warp_weights_1d(src_coord, img_shape_trunc[idim], interpolation);
     }
+    append_tensor_product_row(weights, img_shape_trunc, 0, idxm, mdat, rowptr);
     idxn.push_back(rowptr);
   }
   // lambda needed here  anyway to capture comm
@@ -240,6 +486,14 @@ Mat_unique build_warp_matrix(
   };
   n_ary_for_each(restore_raw_array, raw_arrs.begin(), raw_arrs.end(), displacements.begin());
 
+  // Columns were computed in natural ordering, map them to PETSc ordering so the matrix applies
+  // directly to DMDA global vectors
+  AO ao_petsctonat; // Borrowed from the dmda, must not be destroyed
+  perr = DMDAGetAO(dmda, &ao_petsctonat);
+  CHKERRABORT(comm, perr);
+  perr = AOApplicationToPetsc(ao_petsctonat, idxm.size(), idxm.data());
+  CHKERRABORT(comm, perr);
+
   Mat_unique warp = create_unique_mat();
   perr = MatCreateMPIAIJWithArrays(
       comm, idxn.size() - 1, idxn.size() - 1, mat_size, mat_size, idxn.data(), idxm.data(),
@@ -249,3 +503,190 @@ Mat_unique build_warp_matrix(
 
   return warp;
 }
+
+void warp_ghosted(MPI_Comm comm, const DM& dmda, const Vec& src_local, uinteger ndim,
+    const std::vector<Vec*>& displacements, WarpInterpolation interpolation, Vec tgt)
+{
+  if (displacements.size() < ndim)
+  {
+    throw std::runtime_error("must have displacement vector for each image dimension");
+  }
+  GhostedBox box(comm, dmda);
+
+  std::vector<const floating*> disp(ndim, nullptr);
+  PetscErrorCode perr;
+  for (uinteger idim = 0; idim < ndim; idim++)
+  {
+    perr = VecGetArrayRead(*displacements[idim], &disp[idim]);
+    CHKERRABORT(comm, perr);
+  }
+  const floating* src;
+  perr = VecGetArrayRead(src_local, &src);
+  CHKERRABORT(comm, perr);
+  floating* out;
+  perr = VecGetArray(tgt, &out);
+  CHKERRABORT(comm, perr);
+
+  // Each sample is the tensor product of 1D weights, contracted one axis at a time with x
+  // innermost so the inner loop runs over contiguous ghosted data
+  std::vector<weightlist> weights(3);
+  bool in_halo = true;
+  integer locidx = 0;
+  for (integer k = box.lo[2]; k < box.lo[2] + box.width[2]; k++)
+  {
+    for (integer j = box.lo[1]; j < box.lo[1] + box.width[1]; j++)
+    {
+      for (integer i = box.lo[0]; i < box.lo[0] + box.width[0]; i++, locidx++)
+      {
+        intvector pix = {i, j, k};
+        for (uinteger idim = 0; idim < 3; idim++)
+        {
+          if (idim < ndim)
+          {
+            warp_weights_1d(pix[idim] + disp[idim][locidx], box.shape[idim], interpolation,
+                weights[idim]);
+          }
+          else
+          {
+            weights[idim].assign(1, std::make_pair(pix[idim], floating(1)));
+          }
+          in_halo &= box.in_ghosts(idim, weights[idim]);
+        }
+        if (!in_halo)
+        {
+          break;
+        }
+        floating zsum = 0;
+        for (const auto& wz : weights[2])
+        {
+          floating ysum = 0;
+          for (const auto& wy : weights[1])
+          {
+            const floating* row = src + box.local_offset(0, wy.first, wz.first) + box.glo[0];
+            floating xsum = 0;
+            for (const auto& wx : weights[0])
+            {
+              xsum += wx.second * row[wx.first];
+            }
+            ysum += wy.second * xsum;
+          }
+          zsum += wz.second * ysum;
+        }
+        out[locidx] = zsum;
+      }
+    }
+  }
+
+  perr = VecRestoreArray(tgt, &out);
+  CHKERRABORT(comm, perr);
+  perr = VecRestoreArrayRead(src_local, &src);
+  CHKERRABORT(comm, perr);
+  for (uinteger idim = 0; idim < ndim; idim++)
+  {
+    perr = VecRestoreArrayRead(*displacements[idim], &disp[idim]);
+    CHKERRABORT(comm, perr);
+  }
+  if (!in_halo)
+  {
+    throw std::runtime_error("warp sample lies outside the ghost region");
+  }
+}
+
+void bspline_prefilter_axis(
+    MPI_Comm comm, const DM& dmda, const Vec& src_local, uinteger axis, Vec tgt)
+{
+  // The inverse of the sampling filter (1, 4, 1)/6 has impulse response sqrt(3) z^|k| with
+  // z = sqrt(3) - 2. Truncated at bspline_prefilter_width the tail is below 1e-5, renormalise so
+  // constants are kept exactly.
+  const floating pole = std::sqrt(3.) - 2;
+  floatvector taps(bspline_prefilter_width + 1);
+  for (integer ioff = 0; ioff <= bspline_prefilter_width; ioff++)
+  {
+    taps[ioff] = std::sqrt(3.) * std::pow(pole, ioff);
+  }
+  floating total = 2 * std::accumulate(taps.cbegin(), taps.cend(), floating(0)) - taps[0];
+  std::transform(taps.cbegin(), taps.cend(), taps.begin(),
+      [total](floating t) -> floating { return t / total; });
+
+  GhostedBox box(comm, dmda);
+  intvector stride = {1, box.gwidth[0], box.gwidth[0] * box.gwidth[1]};
+  integer n = box.shape[axis];
+
+  const floating* src;
+  PetscErrorCode perr = VecGetArrayRead(src_local, &src);
+  CHKERRABORT(comm, perr);
+  floating* out;
+  perr = VecGetArray(tgt, &out);
+  CHKERRABORT(comm, perr);
+  bool in_halo = true;
+  integer locidx = 0;
+  for (integer k = box.lo[2]; k < box.lo[2] + box.width[2]; k++)
+  {
+    for (integer j = box.lo[1]; j < box.lo[1] + box.width[1]; j++)
+    {
+      for (integer i = box.lo[0]; i < box.lo[0] + box.width[0]; i++, locidx++)
+      {
+        intvector pix = {i, j, k};
+        integer pos = pix[axis];
+        // offset of this pixel's line, the axis coordinate is added per tap
+        integer base = box.local_offset(i, j, k) - (pos - box.glo[axis]) * stride[axis];
+        floating acc = 0;
+        for (integer ioff = -bspline_prefilter_width; ioff <= bspline_prefilter_width; ioff++)
+        {
+          integer idx = mirror_index(pos + ioff, n) - box.glo[axis];
+          if (idx < 0 || idx >= box.gwidth[axis])
+          {
+            in_halo = false;
+            continue;
+          }
+          acc += taps[std::abs(ioff)] * src[base + idx * stride[axis]];
+        }
+        out[locidx] = acc;
+      }
+    }
+  }
+  perr = VecRestoreArray(tgt, &out);
+  CHKERRABORT(comm, perr);
+  perr = VecRestoreArrayRead(src_local, &src);
+  CHKERRABORT(comm, perr);
+  if (!in_halo)
+  {
+    throw std::runtime_error("prefilter stencil lies outside the ghost region");
+  }
+}
+
+Mat_unique build_resample_matrix(
+    MPI_Comm comm, const intvector& map_shape, uinteger ndim, const floatvector2d& coords)
+{
+  intvector map_shape_trunc(ndim, 0);
+  std::copy_n(map_shape.begin(), ndim, map_shape_trunc.begin());
+  integer map_size =
+      std::accumulate(map_shape_trunc.begin(), map_shape_trunc.end(), 1, std::multiplies<>());
+  integer nrows = coords.size();
+
+  // construct CSR format directly
+  intvector idxn, idxm;
+  floatvector mdat;
+  integer rowptr = 0;
+  idxn.push_back(rowptr);
+
+  std::vector<weightlist> weights(ndim);
+  for (integer row = 0; row < nrows; row++)
+  {
+    for (uinteger idim = 0; idim < ndim; idim++)
+    {
+      weights[idim] =
+          warp_weights_1d(coords[row][idim], map_shape_trunc[idim], WarpInterpolation::linear);
+    }
+    append_tensor_product_row(weights, map_shape_trunc, 0, idxm, mdat, rowptr);
+    idxn.push_back(rowptr);
+  }
+
+  Mat_unique resample = create_unique_mat();
+  PetscErrorCode perr = MatCreateMPIAIJWithArrays(comm, nrows, nrows, map_size, map_size,
+      idxn.data(), idxm.data(), mdat.data(), resample.get());
+  CHKERRABORT(comm, perr);
+  debug_creation(*resample, "Resample matrix");
+
+  return resample;
+}
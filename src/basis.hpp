@@ -21,30 +21,65 @@
 #include <iterator>
 #include <numeric>
 #include <stdexcept>
+#include <string>
+#include <utility>
 
 #include "types.hpp"
 
+// Shape of the map basis functions: tensor-product hat functions (2^ndim support) or
+// tensor-product cubic B-splines (4^ndim support)
+enum class BasisType { linear, cubic };
+
+BasisType basis_type_from_string(const std::string& name);
+
+// With dyadic_refinement the matrix maps B-spline coefficients on the source grid to the
+// coefficients of the same spline on a grid of half the spacing (requires scalings of 0.5),
+// rather than sampling the basis functions at the target locations.
 Mat_unique build_basis_matrix(
     MPI_Comm comm, const intvector& src_shape, const intvector& tgt_shape,
-    const floatvector& scalings, const floatvector& offsets, uinteger ndim, uinteger tile_dim);
+    const floatvector& scalings, const floatvector& offsets, uinteger ndim, uinteger tile_dim,
+    BasisType basis_type = BasisType::linear, bool dyadic_refinement = false);
+
+// Single component basis sampled at the pixels of dmda, rows in PETSc ordering with the same
+// ownership as the image vectors
+Mat_unique build_image_basis_matrix(
+    MPI_Comm comm, const DM& dmda, const intvector& src_shape, const floatvector& scalings,
+    const floatvector& offsets, uinteger ndim, BasisType basis_type = BasisType::linear);
+
+// Image interpolation used when warping: linear, cubic B-spline (the source image must first be
+// prefiltered to B-spline coefficients) or Lanczos-2 windowed sinc
+enum class WarpInterpolation { linear, cubic, sinc };
+
+WarpInterpolation warp_interpolation_from_string(const std::string& name);
 
+// Warp matrix for an image on dmda, rows and columns in PETSc (DMDA global) ordering. Used when
+// the displacements are too large for warp_ghosted.
 Mat_unique build_warp_matrix(
-    MPI_Comm comm, const intvector& img_shape, uinteger ndim,
-    const std::vector<Vec*>& displacements);
+    MPI_Comm comm, const DM& dmda, const intvector& img_shape, uinteger ndim,
+    const std::vector<Vec*>& displacements,
+    WarpInterpolation interpolation = WarpInterpolation::linear);
 
-template <
-    class Input1, class Input2, class Rtype = typename std::iterator_traits<Input1>::value_type>
-Rtype calculate_basis_coefficient(Input1 first1, Input1 last1, Input2 first2)
-{
-  Rtype res = 1;
-  auto it1 = first1;
-  auto it2 = first2;
-  for (; it1 != last1;)
-  {
-    res *= 1 - std::abs(*it1++ - *it2++);
-  }
-  return res;
-}
+// Halo-local warp: sample the ghosted local array src_local of dmda at each owned pixel plus its
+// displacement, writing the owned part of tgt. The ghost region must be at least the largest
+// displacement plus two wide, throws if a sample falls outside it.
+void warp_ghosted(MPI_Comm comm, const DM& dmda, const Vec& src_local, uinteger ndim,
+    const std::vector<Vec*>& displacements, WarpInterpolation interpolation, Vec tgt);
+
+// Half width of the cubic B-spline prefilter, the ghost region along a split axis must be at
+// least this wide
+constexpr integer bspline_prefilter_width = 10;
+
+// One axis of the separable cubic B-spline prefilter with mirrored boundaries: filter the
+// ghosted local array src_local of dmda along axis, writing the owned part of tgt. Applying it
+// along every axis in turn gives the coefficients whose B-spline interpolates the image.
+void bspline_prefilter_axis(
+    MPI_Comm comm, const DM& dmda, const Vec& src_local, uinteger axis, Vec tgt);
+
+// Resampling matrix for one component of the map displacements. Each locally owned node (in
+// order) samples the component at coords[row] (in node units, linear interpolation, clamped to
+// the grid), the rows and columns share the map's node layout.
+Mat_unique build_resample_matrix(
+    MPI_Comm comm, const intvector& map_shape, uinteger ndim, const floatvector2d& coords);
 
 inline floating clamp_to_edge(floating idx, integer dimsize)
 {
@@ -17,6 +17,38 @@
 
 #include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <petscdmda.h>
+
+namespace
+{
+void balance_print(const MPI_Comm &comm, const std::string &name,
+                   const std::vector<std::string> &labels, std::vector<double> values)
+{
+  int size;
+  MPI_Comm_size(comm, &size);
+  std::vector<double> mins(values), maxs(values);
+  MPI_Allreduce(MPI_IN_PLACE, mins.data(), mins.size(), MPI_DOUBLE, MPI_MIN, comm);
+  MPI_Allreduce(MPI_IN_PLACE, maxs.data(), maxs.size(), MPI_DOUBLE, MPI_MAX, comm);
+  MPI_Allreduce(MPI_IN_PLACE, values.data(), values.size(), MPI_DOUBLE, MPI_SUM, comm);
+
+  std::ostringstream msg;
+  msg << "Load balance \"" << name << "\" (" << size << " ranks):\n"
+      << "\t" << std::setw(16) << std::left << "" << std::right << std::setw(12) << "min"
+      << std::setw(12) << "mean" << std::setw(12) << "max" << std::setw(8) << "imbal\n";
+  for (size_t idx = 0; idx < labels.size(); idx++)
+  {
+    double mean = values[idx] / size;
+    msg << "\t" << std::setw(16) << std::left << labels[idx] << std::right << std::fixed
+        << std::setprecision(0) << std::setw(12) << mins[idx] << std::setw(12) << mean
+        << std::setw(12) << maxs[idx] << std::setprecision(2) << std::setw(8)
+        << (mean > 0 ? maxs[idx] / mean : 1.) << "\n";
+  }
+  PetscPrintf(comm, msg.str().c_str());
+}
+} // anonymous namespace
 
 void matrix_dbg_print(const MPI_Comm &comm, const Mat &mat, const std::string &name)
 {
@@ -49,3 +81,53 @@ void matrix_dbg_print(const MPI_Comm &comm, const Mat &mat, const std::string &n
     MPI_Barrier(comm);
   }
 }
+
+void matrix_balance_print(const MPI_Comm &comm, const Mat &mat, const std::string &name)
+{
+  integer row_lo, row_hi;
+  PetscErrorCode perr = MatGetOwnershipRange(mat, &row_lo, &row_hi);
+  CHKERRABORT(comm, perr);
+
+  int size;
+  MPI_Comm_size(comm, &size);
+  Mat diag = mat, offdiag = nullptr;
+  const integer *colmap;
+  if (size > 1)
+  {
+    perr = MatMPIAIJGetSeqAIJ(mat, &diag, &offdiag, &colmap);
+    CHKERRABORT(comm, perr);
+  }
+
+  MatInfo info;
+  perr = MatGetInfo(diag, MAT_LOCAL, &info);
+  CHKERRABORT(comm, perr);
+  double diag_nnz = info.nz_used;
+  double offdiag_nnz = 0;
+  integer ghost_cols = 0;
+  if (offdiag != nullptr)
+  {
+    perr = MatGetInfo(offdiag, MAT_LOCAL, &info);
+    CHKERRABORT(comm, perr);
+    offdiag_nnz = info.nz_used;
+    perr = MatGetSize(offdiag, nullptr, &ghost_cols);
+    CHKERRABORT(comm, perr);
+  }
+
+  balance_print(comm, name, {"rows", "nonzeros", "offdiag nonzeros", "ghost columns"},
+      {static_cast<double>(row_hi - row_lo), diag_nnz + offdiag_nnz, offdiag_nnz,
+       static_cast<double>(ghost_cols)});
+}
+
+void dmda_balance_print(const MPI_Comm &comm, const DM &dmda, const std::string &name)
+{
+  integer x, y, z, m, n, p;
+  PetscErrorCode perr = DMDAGetCorners(dmda, &x, &y, &z, &m, &n, &p);
+  CHKERRABORT(comm, perr);
+  integer gx, gy, gz, gm, gn, gp;
+  perr = DMDAGetGhostCorners(dmda, &gx, &gy, &gz, &gm, &gn, &gp);
+  CHKERRABORT(comm, perr);
+
+  double owned = m * n * p;
+  balance_print(comm, name, {"owned points", "ghost points"},
+      {owned, gm * gn * gp - owned});
+}
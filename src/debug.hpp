@@ -18,10 +18,17 @@
 
 #include <string>
 
+#include <petscdm.h>
 #include <petscmat.h>
 
 #include "types.hpp"
 
 void matrix_dbg_print(const MPI_Comm &comm, const Mat &mat, const std::string &name);
 
+// Load balance summaries, min/mean/max over ranks printed on rank 0. For an MPIAIJ matrix: owned
+// rows, nonzeros, off-diagonal block nonzeros and ghost columns (the MatMult scatter size). For a
+// DMDA: owned points and ghost points received in a halo exchange.
+void matrix_balance_print(const MPI_Comm &comm, const Mat &mat, const std::string &name);
+void dmda_balance_print(const MPI_Comm &comm, const DM &dmda, const std::string &name);
+
 #endif // DEBUG_HPP
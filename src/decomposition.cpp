@@ -0,0 +1,341 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "decomposition.hpp"
+
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
+
+#include <petscsys.h>
+
+namespace ba = boost::algorithm;
+
+namespace
+{
+struct Settings {
+  decomposition::Policy policy = decomposition::Policy::petsc;
+  intvector process_grid;
+  intvector2d ownership = intvector2d(3);
+};
+
+Settings settings;
+
+intvector parse_intlist(const std::string& str)
+{
+  intvector values;
+  if (ba::trim_copy(str).empty())
+  {
+    return values;
+  }
+  std::vector<std::string> parts;
+  ba::split(parts, ba::trim_copy(str), ba::is_any_of("x, "), ba::token_compress_on);
+  std::transform(parts.cbegin(), parts.cend(), std::back_inserter(values),
+      [](const std::string& s) -> integer { return std::stoll(s); });
+  return values;
+}
+
+integer ceil_div(integer a, integer b)
+{
+  return (a + b - 1) / b;
+}
+
+// Largest local block plus the halo it exchanges, in grid points
+integer partition_cost(const intvector& shape, const intvector& procs)
+{
+  intvector extent(3, 1);
+  std::transform(shape.cbegin(), shape.cend(), procs.cbegin(), extent.begin(), ceil_div);
+  integer volume = extent[0] * extent[1] * extent[2];
+  integer halo = 0;
+  for (uinteger idim = 0; idim < 3; idim++)
+  {
+    if (procs[idim] > 1)
+    {
+      halo += 2 * volume / extent[idim];
+    }
+  }
+  return volume + halo;
+}
+
+bool grid_fits(const intvector& shape, const intvector& procs)
+{
+  return procs.size() == 3 && procs[0] <= shape[0] && procs[1] <= shape[1]
+         && procs[2] <= shape[2];
+}
+
+// The DMDA places ranks on the grid with x fastest, so node_ranks consecutive ranks only form a
+// box when they fill part of a row, whole rows of a plane or whole planes. Empty if they don't.
+intvector node_block(const intvector& procs, integer node_ranks)
+{
+  integer lower = 1;
+  intvector block(3, 1);
+  for (uinteger idim = 0; idim < 3; idim++)
+  {
+    if (node_ranks <= lower * procs[idim])
+    {
+      if ((lower * procs[idim]) % node_ranks != 0 || node_ranks % lower != 0)
+      {
+        return intvector();
+      }
+      block[idim] = node_ranks / lower;
+      return block;
+    }
+    block[idim] = procs[idim];
+    lower *= procs[idim];
+  }
+  return intvector();
+}
+
+// Halo a node exchanges with other nodes, per rank on the node, in grid points
+integer internode_cost(const intvector& shape, const intvector& procs, integer node_ranks)
+{
+  intvector extent(3, 1);
+  std::transform(shape.cbegin(), shape.cend(), procs.cbegin(), extent.begin(), ceil_div);
+  intvector block = node_block(procs, node_ranks);
+  if (block.empty())
+  {
+    // Scattered over the grid, assume every face of every rank leaves the node
+    block = intvector(3, 1);
+    node_ranks = 1;
+  }
+  intvector box(3, 1);
+  std::transform(extent.cbegin(), extent.cend(), block.cbegin(), box.begin(),
+      std::multiplies<>());
+  integer volume = box[0] * box[1] * box[2];
+  integer halo = 0;
+  for (uinteger idim = 0; idim < 3; idim++)
+  {
+    if (procs[idim] > block[idim])
+    {
+      halo += 2 * volume / box[idim];
+    }
+  }
+  return ceil_div(halo, node_ranks);
+}
+} // anonymous namespace
+
+void decomposition::configure(const ConfigurationBase& config)
+{
+  std::string policy = config.grab<std::string>("decomposition");
+  if (policy == "petsc")
+  {
+    settings.policy = Policy::petsc;
+  }
+  else if (policy == "balanced")
+  {
+    settings.policy = Policy::balanced;
+  }
+  else if (policy == "topology")
+  {
+    settings.policy = Policy::topology;
+  }
+  else
+  {
+    throw std::runtime_error("decomposition must be one of petsc, balanced, topology");
+  }
+
+  settings.process_grid = parse_intlist(config.grab<std::string>("process_grid"));
+  if (!settings.process_grid.empty() && settings.process_grid.size() != 3)
+  {
+    throw std::runtime_error("process_grid must give ranks for 3 dimensions, e.g 4x2x1");
+  }
+  settings.ownership[0] = parse_intlist(config.grab<std::string>("ownership_x"));
+  settings.ownership[1] = parse_intlist(config.grab<std::string>("ownership_y"));
+  settings.ownership[2] = parse_intlist(config.grab<std::string>("ownership_z"));
+}
+
+decomposition::Policy decomposition::policy()
+{
+  return settings.policy;
+}
+
+intvector decomposition::even_ownership(integer size, integer nparts)
+{
+  intvector ownership(nparts, size / nparts);
+  std::fill_n(ownership.begin(), size % nparts, size / nparts + 1);
+  return ownership;
+}
+
+decomposition::GridPartition decomposition::balanced_partition(const intvector& shape,
+                                                               integer nranks)
+{
+  return topology_partition(shape, nranks, 1);
+}
+
+decomposition::GridPartition decomposition::topology_partition(const intvector& shape,
+                                                               integer nranks, integer node_ranks)
+{
+  GridPartition part;
+  integer best_cost = std::numeric_limits<integer>::max();
+  for (integer m = 1; m <= nranks; m++)
+  {
+    if (nranks % m != 0)
+    {
+      continue;
+    }
+    for (integer n = 1; n <= nranks / m; n++)
+    {
+      if ((nranks / m) % n != 0)
+      {
+        continue;
+      }
+      intvector procs = {m, n, nranks / (m * n)};
+      if (!grid_fits(shape, procs))
+      {
+        continue;
+      }
+      integer cost = partition_cost(shape, procs);
+      if (node_ranks > 1)
+      {
+        cost += internode_cost(shape, procs, node_ranks);
+      }
+      if (cost < best_cost)
+      {
+        best_cost = cost;
+        part.procs = procs;
+      }
+    }
+  }
+  if (best_cost == std::numeric_limits<integer>::max())
+  {
+    return part;
+  }
+  for (uinteger idim = 0; idim < 3; idim++)
+  {
+    part.ownership[idim] = even_ownership(shape[idim], part.procs[idim]);
+  }
+  return part;
+}
+
+integer decomposition::ranks_per_node(MPI_Comm comm)
+{
+  int rank, node_rank, node_size;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm nodecomm;
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodecomm);
+  MPI_Comm_rank(nodecomm, &node_rank);
+  MPI_Comm_size(nodecomm, &node_size);
+  int lowest;
+  MPI_Allreduce(&rank, &lowest, 1, MPI_INT, MPI_MIN, nodecomm);
+  MPI_Comm_free(&nodecomm);
+
+  // Nodes must all be the same size and hold consecutive ranks
+  int sizes[2] = {node_size, -node_size};
+  MPI_Allreduce(MPI_IN_PLACE, sizes, 2, MPI_INT, MPI_MAX, comm);
+  int consecutive = (rank == lowest + node_rank) ? 1 : 0;
+  MPI_Allreduce(MPI_IN_PLACE, &consecutive, 1, MPI_INT, MPI_LAND, comm);
+  if (sizes[0] == -sizes[1] && consecutive)
+  {
+    return node_size;
+  }
+
+  // Ranks are never reordered, so the grid alone cannot keep such nodes compact. Say so once
+  // rather than for every map.
+  static bool reported = false;
+  if (!reported)
+  {
+    PetscPrintf(comm, "Topology decomposition: %s, using the balanced decomposition instead\n",
+        consecutive ? "nodes hold different numbers of ranks"
+                    : "node ranks are not consecutively numbered");
+    reported = true;
+  }
+  return 1;
+}
+
+decomposition::GridPartition decomposition::image_partition(const intvector& shape,
+                                                            MPI_Comm comm)
+{
+  int nranks;
+  MPI_Comm_size(comm, &nranks);
+
+  GridPartition part;
+  if (settings.policy == Policy::balanced)
+  {
+    part = balanced_partition(shape, nranks);
+  }
+  else if (settings.policy == Policy::topology)
+  {
+    part = topology_partition(shape, nranks, ranks_per_node(comm));
+  }
+  if (!settings.process_grid.empty())
+  {
+    if (settings.process_grid[0] * settings.process_grid[1] * settings.process_grid[2] != nranks)
+    {
+      throw std::runtime_error("process_grid does not match the number of ranks");
+    }
+    part.procs = settings.process_grid;
+    part.ownership = intvector2d(3);
+  }
+  for (uinteger idim = 0; idim < 3; idim++)
+  {
+    const intvector& owned = settings.ownership[idim];
+    if (owned.empty())
+    {
+      continue;
+    }
+    if (std::accumulate(owned.cbegin(), owned.cend(), integer(0)) != shape[idim])
+    {
+      throw std::runtime_error("ownership ranges must sum to the image size in each dimension");
+    }
+    if (!settings.process_grid.empty()
+        && settings.process_grid[idim] != static_cast<integer>(owned.size()))
+    {
+      throw std::runtime_error("ownership ranges do not match process_grid");
+    }
+    part.procs[idim] = owned.size();
+    part.ownership[idim] = owned;
+  }
+  // Ranks in other dimensions must be recomputed by PETSc if they no longer multiply up
+  if (std::none_of(part.procs.cbegin(), part.procs.cend(),
+                   [](integer p) -> bool { return p == PETSC_DECIDE; })
+      && part.procs[0] * part.procs[1] * part.procs[2] != nranks)
+  {
+    for (uinteger idim = 0; idim < 3; idim++)
+    {
+      if (settings.ownership[idim].empty())
+      {
+        part.procs[idim] = PETSC_DECIDE;
+        part.ownership[idim].clear();
+      }
+    }
+  }
+  return part;
+}
+
+decomposition::GridPartition decomposition::map_partition(const intvector& shape, MPI_Comm comm)
+{
+  int nranks;
+  MPI_Comm_size(comm, &nranks);
+
+  // Explicit ownership ranges are image sized so only the process grid carries over, and only
+  // when the (much coarser) map has enough nodes for it
+  if (!settings.process_grid.empty() && grid_fits(shape, settings.process_grid))
+  {
+    GridPartition part;
+    part.procs = settings.process_grid;
+    return part;
+  }
+  if (settings.policy == Policy::balanced)
+  {
+    return balanced_partition(shape, nranks);
+  }
+  if (settings.policy == Policy::topology)
+  {
+    return topology_partition(shape, nranks, ranks_per_node(comm));
+  }
+  return GridPartition();
+}
@@ -0,0 +1,69 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#ifndef DECOMPOSITION_HPP
+#define DECOMPOSITION_HPP
+
+#include <mpi.h>
+
+#include "types.hpp"
+#include "baseconfiguration.hpp"
+
+// Partitioning of the image and map DMDAs across ranks.
+//
+// The policy is global and set once from the configuration. "petsc" leaves the choice to
+// PETSc. "balanced" searches all process grids for the one that minimises the largest local
+// block plus its halo, which behaves better than PETSc's choice for awkward shapes and rank
+// counts. "topology" also accounts for which ranks share a compute node, preferring grids where
+// each node's ranks own a compact box so that most halo faces stay on-node. It only chooses the
+// grid shape, ranks keep their order, so it relies on each node holding consecutive ranks and
+// falls back to "balanced" (with a message) when they don't. A process grid and explicit image
+// ownership ranges can also be given.
+namespace decomposition
+{
+enum class Policy { petsc, balanced, topology };
+
+struct GridPartition {
+  // Ranks per dimension, PETSC_DECIDE where unset
+  intvector procs = intvector(3, PETSC_DECIDE);
+  // Nodes owned by each rank along each dimension, empty lets PETSc choose
+  intvector2d ownership = intvector2d(3);
+
+  const integer* ownership_ptr(uinteger dim) const
+  {
+    return ownership[dim].empty() ? nullptr : ownership[dim].data();
+  }
+};
+
+void configure(const ConfigurationBase& config);
+Policy policy();
+
+GridPartition image_partition(const intvector& shape, MPI_Comm comm);
+GridPartition map_partition(const intvector& shape, MPI_Comm comm);
+
+// Best process grid for shape over nranks with even ownership, procs left as PETSC_DECIDE if no
+// grid fits
+GridPartition balanced_partition(const intvector& shape, integer nranks);
+// As balanced_partition, with halo faces between nodes of node_ranks consecutive ranks counted
+// twice
+GridPartition topology_partition(const intvector& shape, integer nranks, integer node_ranks);
+// Ranks per shared memory node if every node has the same number of consecutively numbered
+// ranks, otherwise 1 and the fallback is reported once (collective)
+integer ranks_per_node(MPI_Comm comm);
+intvector even_ownership(integer size, integer nparts);
+
+} // namespace decomposition
+
+#endif // DECOMPOSITION_HPP
@@ -0,0 +1,44 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "dictconfiguration.hpp"
+
+DictConfig::DictConfig(const config_map &options, const std::string &invocation)
+  : ConfigurationBase(invocation)
+{
+  for (const auto &it : options)
+  {
+    set(it.first, it.second);
+  }
+}
+
+void DictConfig::set(const std::string &key, const std::string &value)
+{
+  if (std::find(arg_options.cbegin(), arg_options.cend(), key) == arg_options.cend()
+      && std::find(bool_options.cbegin(), bool_options.cend(), key) == bool_options.cend())
+  {
+    throw std::runtime_error("unknown configuration option \"" + key + "\"");
+  }
+  config[key] = value;
+}
+
+void DictConfig::set_petsc(
+    const std::string &section, const std::string &key, const std::string &value)
+{
+  if (!add_petsc_option(section, key, value))
+  {
+    throw std::runtime_error("invalid PETSc option \"" + section + "." + key + "\"");
+  }
+}
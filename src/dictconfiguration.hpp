@@ -0,0 +1,33 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#ifndef DICTCONFIGURATION_HPP
+#define DICTCONFIGURATION_HPP
+
+#include <string>
+
+#include "baseconfiguration.hpp"
+#include "types.hpp"
+
+// Configuration supplied directly as key-value pairs, for driving pFIRE from other programs
+class DictConfig: public ConfigurationBase {
+public:
+  explicit DictConfig(const config_map &options, const std::string &invocation = "pfire");
+
+  void set(const std::string &key, const std::string &value);
+  // As a key in a [petsc] or [petsc.genN] section of a configuration file
+  void set_petsc(const std::string &section, const std::string &key, const std::string &value);
+};
+#endif // DICTCONFIGURATION_HPP
@@ -15,13 +15,160 @@
 
 #include "elastic.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
 #include <iomanip>
+#include <limits>
+#include <numeric>
 #include <sstream>
 
+#include "debug.hpp"
 #include "fd_routines.hpp"
 #include "infix_iterator.hpp"
 #include "iterator_routines.hpp"
 #include "petsc_debug.hpp"
+#include "petsc_helpers.hpp"
+#include "profiling.hpp"
+#include "reduction.hpp"
+
+namespace {
+
+// Give a nested solver its types unless options under its prefix already choose them. They are
+// set on the objects so nothing is left in the options database for later solvers.
+void set_sub_solver_default(MPI_Comm comm, KSP sub, const char* ksp_type, const char* pc_type)
+{
+  const char* prefix;
+  PetscErrorCode perr = KSPGetOptionsPrefix(sub, &prefix);
+  CHKERRABORT(comm, perr);
+  PetscBool set;
+  if (ksp_type != nullptr)
+  {
+    perr = PetscOptionsHasName(nullptr, prefix, "-ksp_type", &set);
+    CHKERRABORT(comm, perr);
+    if (!set)
+    {
+      perr = KSPSetType(sub, ksp_type);
+      CHKERRABORT(comm, perr);
+    }
+  }
+  perr = PetscOptionsHasName(nullptr, prefix, "-pc_type", &set);
+  CHKERRABORT(comm, perr);
+  if (!set)
+  {
+    PC pc;
+    perr = KSPGetPC(sub, &pc);
+    CHKERRABORT(comm, perr);
+    perr = PCSetType(pc, pc_type);
+    CHKERRABORT(comm, perr);
+  }
+}
+
+// Solve the Gram system G c = p in place by Cholesky. Nearly dependent vectors would make it
+// singular, so any whose pivot collapses is dropped and gets a zero coefficient.
+void solve_gram(floatvector& gram, floatvector& coeffs)
+{
+  const floating drop_tol = 1e-10;
+  size_t nvec = coeffs.size();
+  std::vector<bool> dropped(nvec, false);
+  for (size_t col = 0; col < nvec; col++)
+  {
+    floating pivot = gram[col * nvec + col];
+    for (size_t k = 0; k < col; k++)
+    {
+      pivot -= gram[col * nvec + k] * gram[col * nvec + k];
+    }
+    if (pivot <= drop_tol * gram[col * nvec + col] || pivot <= 0)
+    {
+      dropped[col] = true;
+      for (size_t row = col; row < nvec; row++)
+      {
+        gram[row * nvec + col] = 0.;
+      }
+      continue;
+    }
+    gram[col * nvec + col] = std::sqrt(pivot);
+    for (size_t row = col + 1; row < nvec; row++)
+    {
+      floating val = gram[row * nvec + col];
+      for (size_t k = 0; k < col; k++)
+      {
+        val -= gram[row * nvec + k] * gram[col * nvec + k];
+      }
+      gram[row * nvec + col] = val / gram[col * nvec + col];
+    }
+  }
+  // forward then back substitution with the lower factor
+  for (size_t row = 0; row < nvec; row++)
+  {
+    for (size_t k = 0; k < row; k++)
+    {
+      coeffs[row] -= gram[row * nvec + k] * coeffs[k];
+    }
+    coeffs[row] = dropped[row] ? 0. : coeffs[row] / gram[row * nvec + row];
+  }
+  for (size_t row = nvec; row-- > 0;)
+  {
+    for (size_t k = row + 1; k < nvec; k++)
+    {
+      coeffs[row] -= gram[k * nvec + row] * coeffs[k];
+    }
+    coeffs[row] = dropped[row] ? 0. : coeffs[row] / gram[row * nvec + row];
+  }
+}
+
+// Layers an options database over the current one for the lifetime of the object, so it is
+// popped again however the scope is left
+class ScopedOptions {
+public:
+  ScopedOptions(MPI_Comm comm, const config_map& overrides) : m_comm(comm), m_options(nullptr)
+  {
+    if (overrides.empty())
+    {
+      return;
+    }
+    // start from a copy of the current database so only the overridden options change
+    char* current;
+    PetscErrorCode perr = PetscOptionsGetAll(nullptr, &current);
+    CHKERRABORT(m_comm, perr);
+    perr = PetscOptionsCreate(&m_options);
+    CHKERRABORT(m_comm, perr);
+    perr = PetscOptionsInsertString(m_options, current);
+    CHKERRABORT(m_comm, perr);
+    perr = PetscFree(current);
+    CHKERRABORT(m_comm, perr);
+    for (const auto& opt : overrides)
+    {
+      const char* value = opt.second.empty() ? nullptr : opt.second.c_str();
+      perr = PetscOptionsSetValue(m_options, opt.first.c_str(), value);
+      CHKERRABORT(m_comm, perr);
+    }
+    perr = PetscOptionsPush(m_options);
+    CHKERRABORT(m_comm, perr);
+  }
+
+  ~ScopedOptions()
+  {
+    if (m_options == nullptr)
+    {
+      return;
+    }
+    PetscErrorCode perr = PetscOptionsPop();
+    CHKERRABORT(m_comm, perr);
+    perr = PetscOptionsDestroy(&m_options);
+    CHKERRABORT(m_comm, perr);
+  }
+
+  ScopedOptions(const ScopedOptions&) = delete;
+  ScopedOptions& operator=(const ScopedOptions&) = delete;
+
+private:
+  MPI_Comm m_comm;
+  PetscOptions m_options;
+};
+
+} // anonymous namespace
 
 Elastic::Elastic(const Image& fixed, const Image& moved, const floatvector nodespacing,
     const ConfigurationBase& configuration)
@@ -34,6 +181,54 @@ Elastic::Elastic(const Image& fixed, const Image& moved, const floatvector nodes
   // TODO: image compatibility checks (maybe write Image.iscompat(Image foo)
   // TODO: enforce normalization
 
+  std::string map_update = configuration.grab<std::string>("map_update");
+  if (map_update != "additive" && map_update != "compositional")
+  {
+    throw std::runtime_error("map_update must be one of additive, compositional");
+  }
+  m_compositional = (map_update == "compositional");
+  BasisType basis_type = basis_type_from_string(configuration.grab<std::string>("basis_type"));
+  if (m_compositional && basis_type != BasisType::linear)
+  {
+    // Composition resamples the map values as nodal displacements, which only holds for the
+    // interpolating linear basis, not for B-spline coefficients
+    throw std::runtime_error("map_update = compositional requires basis_type = linear");
+  }
+  m_symmetric_scaling = configuration.grab<bool>("symmetric_scaling");
+
+  m_solver = configuration.grab<std::string>("solver");
+  if (m_solver != "normal" && m_solver != "lsqr")
+  {
+    throw std::runtime_error("solver must be one of normal, lsqr");
+  }
+
+  m_fieldsplit = configuration.grab<std::string>("fieldsplit");
+  if (m_fieldsplit != "none" && m_fieldsplit != "additive" && m_fieldsplit != "multiplicative"
+      && m_fieldsplit != "symmetric_multiplicative" && m_fieldsplit != "schur")
+  {
+    throw std::runtime_error("fieldsplit must be one of none, additive, multiplicative, "
+                             "symmetric_multiplicative, schur");
+  }
+  m_direct_solve_size = configuration.grab<integer>("direct_solve_size");
+  m_autotune = configuration.grab<bool>("autotune");
+  m_krylov_recycle = configuration.grab<integer>("krylov_recycle");
+  m_operator_lag = configuration.grab<integer>("operator_lag");
+  if (m_operator_lag < 1)
+  {
+    throw std::runtime_error("operator_lag must be at least 1");
+  }
+  m_line_search = configuration.grab<bool>("line_search");
+  m_inexact_newton = configuration.grab<bool>("inexact_newton");
+
+  if (m_fieldsplit != "none" && m_solver == "lsqr")
+  {
+    throw std::runtime_error("fieldsplit requires solver = normal");
+  }
+  if (m_autotune && (m_fieldsplit != "none" || m_solver != "normal"))
+  {
+    throw std::runtime_error("autotune requires solver = normal and fieldsplit = none");
+  }
+
   // make sure nodespacing is compatible with image
   if (m_fixed.ndim() != m_v_final_nodespacing.size())
   {
@@ -51,10 +246,12 @@ Elastic::Elastic(const Image& fixed, const Image& moved, const floatvector nodes
   calculate_node_spacings();
 
   // make map, need to ensure basis is always the same layout
-  m_p_map = std::make_unique<Map>(fixed, m_v_nodespacings.back());
+  m_p_map = std::make_unique<Map>(fixed, m_v_nodespacings.back(), basis_type);
 
   // set scratchpad storage, scatterers:
   m_workspace = std::make_shared<WorkSpace>(fixed, *m_p_map);
+  m_workspace->m_warp_interpolation =
+      warp_interpolation_from_string(configuration.grab<std::string>("warp_interpolation"));
 }
 
 void Elastic::autoregister()
@@ -77,16 +274,26 @@ void Elastic::autoregister()
     nsmsg << std::endl;
     PetscPrintf(m_comm, nsmsg.str().c_str());
 
-    innerloop(loop_count);
+    profiling::set_generation(loop_count);
+    {
+      ScopedOptions options(m_comm, generation_options(loop_count));
+      innerloop(loop_count);
+    }
+    profiling::add_count("generations");
     std::advance(it, 1);
     if (it == m_v_nodespacings.rend())
     {
       break;
     }
     m_v_nodespacings.erase(it.base());
+    // Interpolation and rewarp belong to the next generation
+    profiling::set_generation(loop_count + 1);
     m_p_map = m_p_map->interpolate(*it);
     m_workspace->reallocate_ephemeral_workspace(*m_p_map);
+    normmat = create_unique_mat();
+    m_scaling.reset();
     m_p_registered = m_p_map->warp(m_moved, *m_workspace);
+    m_phi = -1;
     loop_count++;
   }
 }
@@ -101,23 +308,28 @@ void Elastic::innerloop(integer outer_count)
   }
 
   floating lambda = 20.0;
+  m_ew_prev_norm = -1;
+  m_prev_phi = -1;
+  m_lag_count = 0;
   for (integer inum = 1; inum <= m_max_iter; inum++)
   {
     PetscPrintf(m_comm, "Iteration %i:\n", inum);
-    innerstep(lambda, inum);
+    bool stepped = innerstep(lambda, inum);
+    profiling::add_count("iterations");
 
     if (configuration.grab<bool>("debug_frames"))
     {
       save_debug_frame(configuration.grab<std::string>("debug_frames_prefix"), outer_count, inum);
     }
 
-    // check convergence and break if below threshold
-    floating posmax, negmax;
-    PetscErrorCode perr = VecMax(*m_workspace->m_delta, nullptr, &posmax);
-    CHKERRABORT(m_comm, perr);
-    perr = VecMin(*m_workspace->m_delta, nullptr, &negmax);
-    CHKERRABORT(m_comm, perr);
-    floating amax = std::max(std::fabs(posmax), std::fabs(negmax));
+    if (!stepped)
+    {
+      PetscPrintf(m_comm, "Generation %i stalled after %i iterations.\n\n", outer_count, inum);
+      break;
+    }
+
+    // check convergence and break if below threshold, reduced with the update
+    floating amax = m_max_delta;
     PetscPrintf(m_comm, "Maximum displacement: %.2f\n", amax);
     if (amax < m_convergence_thres)
     {
@@ -127,54 +339,717 @@ void Elastic::innerloop(integer outer_count)
   }
 }
 
-void Elastic::innerstep(floating lambda, integer inum)
+config_map Elastic::generation_options(integer generation) const
+{
+  // The generation's options without their prefix, so they reach every solver object created
+  // during the generation including nested ones. Values come from the database, where any given
+  // outside the configuration file have precedence.
+  std::string prefix = "-" + ConfigurationBase::generation_prefix(generation);
+  config_map overrides;
+  for (const auto& opt : configuration.petsc_options())
+  {
+    if (opt.first.compare(0, prefix.size(), prefix) != 0)
+    {
+      continue;
+    }
+    std::vector<char> value(PETSC_MAX_PATH_LEN, '\0');
+    PetscBool set;
+    PetscErrorCode perr = PetscOptionsGetString(
+        nullptr, nullptr, opt.first.c_str(), value.data(), value.size(), &set);
+    CHKERRABORT(m_comm, perr);
+    overrides["-" + opt.first.substr(prefix.size())] = set ? value.data() : opt.second;
+  }
+  if (!overrides.empty())
+  {
+    PetscPrintf(m_comm, "Using %i generation specific PETSc options\n",
+        static_cast<int>(overrides.size()));
+  }
+  return overrides;
+}
+
+bool Elastic::innerstep(floating lambda, integer inum)
 {
   // calculate up to date tmat
   calculate_tmat(inum);
 
+  // stack the residual [f-m f-m f-m f-m], both solvers need it as their data term
+  floating phi0 = residual_norm2();
+  m_workspace->duplicate_single_grad_to_stacked(0);
+
+  bool least_squares = (m_solver == "lsqr");
+  bool rebuild = least_squares || operator_outdated(phi0);
+  if (least_squares)
+  {
+    assemble_least_squares(lambda);
+  }
+  else if (rebuild)
+  {
+    assemble_normal_system(lambda, inum);
+  }
+  else
+  {
+    PetscPrintf(m_comm, "Reusing normal matrix\n");
+    profiling::ScopedPhase phase("normal_matrix");
+    assemble_normal_rhs();
+  }
+  PetscErrorCode perr;
+  Mat& op = least_squares ? *m_workspace->m_augmented : *normmat;
+  Vec& rhs = least_squares ? *m_workspace->m_augmented_rhs : *m_workspace->m_rhs;
+
+  if (inum == 1 && configuration.grab<bool>("debug_balance"))
+  {
+    dmda_balance_print(m_comm, *m_fixed.dmda(), "image");
+    matrix_balance_print(m_comm, *m_p_map->basis(), "basis");
+    if (!least_squares)
+    {
+      matrix_balance_print(m_comm, *normmat, "normal matrix");
+    }
+  }
+
+  // solve for delta a
+  profiling::begin_phase("solve");
+  // KSP lives for the generation, the preconditioner is rebuilt as normmat has changed
+  KSP& ksp = *m_workspace->m_ksp;
+  bool created = (ksp == nullptr);
+  if (created)
+  {
+    // tune on the first system seen, i.e. the coarsest generation
+    if (m_autotune && m_tuned_ksp.empty())
+    {
+      autotune(op, rhs);
+    }
+    perr = KSPCreate(m_comm, &ksp);
+    CHKERRABORT(m_comm, perr);
+    perr = KSPSetOperators(ksp, op, op);
+    CHKERRABORT(m_comm, perr);
+    bool direct = setup_direct_solve(ksp);
+    if (!m_tuned_ksp.empty())
+    {
+      perr = KSPSetType(ksp, m_tuned_ksp.c_str());
+      CHKERRABORT(m_comm, perr);
+      PC pc;
+      perr = KSPGetPC(ksp, &pc);
+      CHKERRABORT(m_comm, perr);
+      perr = PCSetType(pc, m_tuned_pc.c_str());
+      CHKERRABORT(m_comm, perr);
+    }
+    else if (least_squares)
+    {
+      // unpreconditioned by default as the columns are already balanced, -pc_type can override
+      perr = KSPSetType(ksp, KSPLSQR);
+      CHKERRABORT(m_comm, perr);
+      PC pc;
+      perr = KSPGetPC(ksp, &pc);
+      CHKERRABORT(m_comm, perr);
+      perr = PCSetType(pc, PCNONE);
+      CHKERRABORT(m_comm, perr);
+    }
+    else if (m_symmetric_scaling && !direct)
+    {
+      // system is SPD, default to CG but let -ksp_type override
+      perr = KSPSetType(ksp, KSPCG);
+      CHKERRABORT(m_comm, perr);
+    }
+    if (m_fieldsplit != "none")
+    {
+      setup_fieldsplit(ksp);
+    }
+    m_recycling = (m_krylov_recycle > 0 && !direct);
+    perr = KSPSetFromOptions(ksp);
+    CHKERRABORT(m_comm, perr);
+  }
+  else
+  {
+    perr = KSPSetOperators(ksp, op, op);
+    CHKERRABORT(m_comm, perr);
+  }
+  // a lagged operator keeps its preconditioner or factorisation as well
+  perr = KSPSetReusePreconditioner(ksp, rebuild ? PETSC_FALSE : PETSC_TRUE);
+  CHKERRABORT(m_comm, perr);
+  if (m_inexact_newton)
+  {
+    perr = KSPSetTolerances(ksp, forcing_term(), PETSC_DEFAULT, PETSC_DEFAULT, PETSC_DEFAULT);
+    CHKERRABORT(m_comm, perr);
+  }
+  perr = KSPSetUp(ksp);
+  CHKERRABORT(m_comm, perr);
+  if (created)
+  {
+    setup_sub_solvers(ksp);
+  }
+  if (m_recycling)
+  {
+    recycled_guess(ksp, op, rhs);
+  }
+  perr = KSPSolve(ksp, rhs, *m_workspace->m_delta);
+  CHKERRABORT(m_comm, perr);
+  if (m_fieldsplit != "none")
+  {
+    // options can still replace the split, so count what was actually used
+    PC pc;
+    perr = KSPGetPC(ksp, &pc);
+    CHKERRABORT(m_comm, perr);
+    PetscBool fieldsplit;
+    perr = PetscObjectTypeCompare(reinterpret_cast<PetscObject>(pc), PCFIELDSPLIT, &fieldsplit);
+    CHKERRABORT(m_comm, perr);
+    if (fieldsplit)
+    {
+      profiling::add_count("fieldsplit_solves");
+    }
+  }
+  if (m_recycling)
+  {
+    recycle_solution();
+  }
+  if (m_symmetric_scaling || least_squares)
+  {
+    perr = VecPointwiseMult(*m_workspace->m_delta, *m_workspace->m_delta, *m_scaling);
+    CHKERRABORT(m_comm, perr);
+  }
+  profiling::end_phase("solve");
+  integer ksp_its;
+  perr = KSPGetIterationNumber(ksp, &ksp_its);
+  CHKERRABORT(m_comm, perr);
+  profiling::add_count("ksp_iterations", ksp_its);
+
+  if (m_line_search)
+  {
+    return line_search(phi0);
+  }
+  apply_update();
+  return true;
+}
+
+floating Elastic::residual_norm2()
+{
+  // leaves f - m in the first gradient temporary
+  const Vec& registered = *m_p_registered->global_vec();
+  PetscErrorCode perr =
+      VecWAXPY(*m_workspace->m_globaltmps[0], -1.0, registered, *m_fixed.global_vec());
+  CHKERRABORT(m_comm, perr);
+
+  // apply_update already reduced the norm unless the image has changed since
+  PetscObjectState state;
+  perr = PetscObjectStateGet(reinterpret_cast<PetscObject>(registered), &state);
+  CHKERRABORT(m_comm, perr);
+  if (m_phi >= 0 && m_phi_vec == registered && m_phi_state == state)
+  {
+    return m_phi;
+  }
+  floating norm;
+  perr = VecNorm(*m_workspace->m_globaltmps[0], NORM_2, &norm);
+  CHKERRABORT(m_comm, perr);
+  profiling::add_count("global_reductions");
+  return norm * norm;
+}
+
+floating Elastic::forcing_term()
+{
+  // Eisenstat-Walker choice 2: solve loosely while the gradient is still falling fast, tighten
+  // as the iteration settles. Parameters are the PETSc SNES defaults.
+  const floating gamma = 1.0;
+  const floating alpha = 0.5 * (1.0 + std::sqrt(5.0));
+  const floating rtol_max = 0.9;
+  const floating threshold = 0.1;
+
+  // the lsqr path does not need T^T r itself, so form it here for the gradient norm
+  PetscErrorCode perr;
+  if (m_solver == "lsqr")
+  {
+    perr = MatMultTranspose(*m_workspace->m_tmat, *m_workspace->m_stacktmp, *m_workspace->m_rhs);
+    CHKERRABORT(m_comm, perr);
+  }
+  floating norm;
+  perr = VecNorm(*m_workspace->m_rhs, NORM_2, &norm);
+  CHKERRABORT(m_comm, perr);
+  profiling::add_count("global_reductions");
+
+  floating rtol = m_ew_prev_rtol;
+  if (m_ew_prev_norm > 0)
+  {
+    rtol = gamma * std::pow(norm / m_ew_prev_norm, alpha);
+    floating safeguard = gamma * std::pow(m_ew_prev_rtol, alpha);
+    if (safeguard > threshold)
+    {
+      rtol = std::max(rtol, safeguard);
+    }
+    rtol = std::min(rtol, rtol_max);
+  }
+  m_ew_prev_norm = norm;
+  m_ew_prev_rtol = rtol;
+  PetscPrintf(m_comm, "Linear solve tolerance: %.2e\n", rtol);
+  return rtol;
+}
+
+void Elastic::apply_update()
+{
+  // update map
+  if (m_compositional)
+  {
+    m_p_map->compose(*m_workspace->m_delta);
+  }
+  else
+  {
+    m_p_map->update(*m_workspace->m_delta);
+  }
+  // warp image
+  m_p_registered = m_p_map->warp(m_moved, *m_workspace);
+  reduce_update();
+}
+
+void Elastic::reduce_update()
+{
+  // Normalizing the image, the data term and the convergence test each need a global reduction.
+  // Their local parts come from one pass over the data and are reduced together: with
+  // normalization factor s, ||f - s m||^2 = f.f - 2 s m.f + s^2 m.m
+  const Vec& registered = *m_p_registered->global_vec();
+  const Vec& fixed = *m_fixed.global_vec();
+  integer localsize, deltasize;
+  PetscErrorCode perr = VecGetLocalSize(registered, &localsize);
+  CHKERRABORT(m_comm, perr);
+  perr = VecGetLocalSize(*m_workspace->m_delta, &deltasize);
+  CHKERRABORT(m_comm, perr);
+
+  // accumulated in double: when the residual is small f.f and the scaled cross terms nearly cancel
+  const floating *mptr, *fptr, *dptr;
+  perr = VecGetArrayRead(registered, &mptr);
+  CHKERRABORT(m_comm, perr);
+  perr = VecGetArrayRead(fixed, &fptr);
+  CHKERRABORT(m_comm, perr);
+  double msum = 0., mm = 0., mf = 0., ff = 0.;
+  for (integer idx = 0; idx < localsize; idx++)
+  {
+    double mval = mptr[idx];
+    msum += mval;
+    mm += mval * mval;
+    mf += mval * fptr[idx];
+  }
+  bool need_ff = (m_fixed_norm2 < 0);
+  for (integer idx = 0; need_ff && idx < localsize; idx++)
+  {
+    double fval = fptr[idx];
+    ff += fval * fval;
+  }
+  perr = VecRestoreArrayRead(fixed, &fptr);
+  CHKERRABORT(m_comm, perr);
+  perr = VecRestoreArrayRead(registered, &mptr);
+  CHKERRABORT(m_comm, perr);
+
+  perr = VecGetArrayRead(*m_workspace->m_delta, &dptr);
+  CHKERRABORT(m_comm, perr);
+  floating amax = 0.;
+  for (integer idx = 0; idx < deltasize; idx++)
+  {
+    amax = std::max(amax, std::fabs(dptr[idx]));
+  }
+  perr = VecRestoreArrayRead(*m_workspace->m_delta, &dptr);
+  CHKERRABORT(m_comm, perr);
+
+  FusedReduction reduction(m_comm);
+  size_t sum_idx = reduction.add_sum(msum);
+  size_t mm_idx = reduction.add_sum(mm);
+  size_t mf_idx = reduction.add_sum(mf);
+  // every rank agrees whether the fixed norm is known, so the packing matches
+  size_t ff_idx = need_ff ? reduction.add_sum(ff) : 0;
+  size_t max_idx = reduction.add_max(amax);
+  reduction.reduce();
+
+  if (need_ff)
+  {
+    m_fixed_norm2 = reduction.result(ff_idx);
+  }
+  double scale = m_p_registered->normalize_with_sum(reduction.result(sum_idx));
+  m_phi = std::max(0., m_fixed_norm2 - 2 * scale * reduction.result(mf_idx)
+                           + scale * scale * reduction.result(mm_idx));
+  m_max_delta = reduction.result(max_idx);
+
+  m_phi_vec = registered;
+  perr = PetscObjectStateGet(reinterpret_cast<PetscObject>(registered), &m_phi_state);
+  CHKERRABORT(m_comm, perr);
+}
+
+bool Elastic::line_search(floating phi0)
+{
+  // Backtrack on the data term until the step gives sufficient (Armijo) decrease against the
+  // slope predicted by the linearization, phi(a + t d) ~ ||r - t T d||^2. delta is scaled in place
+  // so the convergence test sees the step actually taken.
+  profiling::ScopedPhase phase("line_search");
+  const floating armijo = 1e-4;
+
+  Vec_shared tdelta = m_workspace->borrow_vec(*m_workspace->m_stacktmp);
+  PetscErrorCode perr = MatMult(*m_workspace->m_tmat, *m_workspace->m_delta, *tdelta);
+  CHKERRABORT(m_comm, perr);
+  floating rtd;
+  perr = VecDot(*m_workspace->m_stacktmp, *tdelta, &rtd);
+  CHKERRABORT(m_comm, perr);
+  profiling::add_count("global_reductions");
+  floating slope = -2 * rtd;
+
+  Vec_shared saved = m_workspace->borrow_vec(*m_p_map->m_displacements);
+  perr = VecCopy(*m_p_map->m_displacements, *saved);
+  CHKERRABORT(m_comm, perr);
+
+  floating step = 1.0;
+  for (integer trial = 0; trial <= m_max_backtracks; trial++)
+  {
+    apply_update();
+    profiling::add_count("line_search_trials");
+    floating phi = residual_norm2();
+    if (phi < phi0 && phi <= phi0 + armijo * step * slope)
+    {
+      PetscPrintf(m_comm, "Line search step: %.3f\n", step);
+      return true;
+    }
+    perr = VecCopy(*saved, *m_p_map->m_displacements);
+    CHKERRABORT(m_comm, perr);
+    perr = VecScale(*m_workspace->m_delta, 0.5);
+    CHKERRABORT(m_comm, perr);
+    step *= 0.5;
+  }
+
+  // No step decreased the residual enough, so keep the map from before the update
+  profiling::add_count("line_search_failures");
+  perr = VecSet(*m_workspace->m_delta, 0.);
+  CHKERRABORT(m_comm, perr);
+  m_p_registered = m_p_map->warp(m_moved, *m_workspace);
+  reduce_update();
+  PetscPrintf(m_comm, "Line search found no sufficient decrease, keeping the previous map\n");
+  return false;
+}
+
+void Elastic::assemble_normal_system(floating lambda, integer inum)
+{
   // calculate tmat2 and precondition
-  normmat = create_unique_mat();
-  // TODO: can we reuse here?
-  PetscErrorCode perr = MatTransposeMatMult(*m_workspace->m_tmat, *m_workspace->m_tmat,
-      MAT_INITIAL_MATRIX, PETSC_DEFAULT, normmat.get());
+  profiling::ScopedPhase phase("normal_matrix");
+  // tmat keeps the basis sparsity pattern for the whole generation so the product is reused
+  MatReuse reuse = (*m_workspace->m_normprod == nullptr) ? MAT_INITIAL_MATRIX : MAT_REUSE_MATRIX;
+  PetscErrorCode perr = MatTransposeMatMult(*m_workspace->m_tmat, *m_workspace->m_tmat, reuse,
+      PETSC_DEFAULT, m_workspace->m_normprod.get());
+  CHKERRABORT(m_comm, perr);
+
+  // T is block diagonal by component, so T^T T + lambda lapl2 is too and every diagonal block has
+  // the pattern of B^T B + lapl2 for the scalar basis B. lapl2 is padded to that pattern once per
+  // generation, then normmat is the tiled padded pattern and lapl2 is added block by block
+  // straight into its value arrays.
+  if (*m_workspace->m_padded_lapl == nullptr)
+  {
+    perr = MatTransposeMatMult(*m_p_map->basis(), *m_p_map->basis(), MAT_INITIAL_MATRIX,
+        PETSC_DEFAULT, m_workspace->m_padded_lapl.get());
+    CHKERRABORT(m_comm, perr);
+    perr = MatZeroEntries(*m_workspace->m_padded_lapl);
+    CHKERRABORT(m_comm, perr);
+    perr = MatAXPY(
+        *m_workspace->m_padded_lapl, 1.0, *m_p_map->laplacian(), DIFFERENT_NONZERO_PATTERN);
+    CHKERRABORT(m_comm, perr);
+    debug_creation(*m_workspace->m_padded_lapl, "Mat_padded_laplacian");
+  }
+  if (*normmat == nullptr)
+  {
+    tile_matrix(m_comm, *m_workspace->m_padded_lapl, m_mapdims, normmat);
+    debug_creation(*normmat, std::string("Mat_normal") + std::to_string(inum));
+  }
+  perr = MatCopy(*m_workspace->m_normprod, *normmat, SUBSET_NONZERO_PATTERN);
   CHKERRABORT(m_comm, perr);
-  debug_creation(*normmat, std::string("Mat_normal") + std::to_string(inum));
   // precondition tmat2
   block_precondition();
 
   // calculate tmat2 + lambda*lapl2
-  perr = MatAXPY(*normmat, lambda, *m_p_map->laplacian(), DIFFERENT_NONZERO_PATTERN);
+  add_stacked_values(m_comm, lambda,
+      std::vector<Mat>(m_mapdims, *m_workspace->m_padded_lapl), *normmat);
+  if (m_symmetric_scaling)
+  {
+    perr = MatSetOption(*normmat, MAT_SYMMETRIC, PETSC_TRUE);
+    CHKERRABORT(m_comm, perr);
+  }
+
+  profiling::add_count("operator_builds");
+  assemble_normal_rhs();
+}
+
+bool Elastic::operator_outdated(floating phi)
+{
+  // Rebuild every m_operator_lag iterations, or sooner if the lagged operator has stopped
+  // reducing the residual
+  bool stalled = (m_prev_phi > 0 && phi > m_stall_ratio * m_prev_phi);
+  m_prev_phi = phi;
+  m_lag_count++;
+  if (*normmat == nullptr || stalled || m_lag_count >= m_operator_lag)
+  {
+    m_lag_count = 0;
+    return true;
+  }
+  return false;
+}
+
+void Elastic::assemble_normal_rhs()
+{
+  // calculate rvec from the stacked residual, tmat is always current so this is the true
+  // gradient even when the normal matrix is lagged
+  PetscErrorCode perr =
+      MatMultTranspose(*m_workspace->m_tmat, *m_workspace->m_stacktmp, *m_workspace->m_rhs);
   CHKERRABORT(m_comm, perr);
+  if (m_symmetric_scaling)
+  {
+    // solving for S^-1 delta, so the rhs picks up the column scaling
+    perr = VecPointwiseMult(*m_workspace->m_rhs, *m_workspace->m_rhs, *m_scaling);
+    CHKERRABORT(m_comm, perr);
+  }
+}
+
+void Elastic::assemble_least_squares(floating lambda)
+{
+  // min ||[T S; sqrt(lambda) L] y - [r; 0]|| with delta = S y has the normal equations
+  // (S T^T T S + lambda L^T L) y = S T^T r of the symmetrically scaled system, without forming
+  // T^T T or L^T L. As there, only the data term is balanced. The operator is a single AIJ so the
+  // solver works with ordinary vectors, each rank holds its rows of T and then its rows of L for
+  // every component.
+  profiling::ScopedPhase phase("least_squares");
+  floating lum_scale = column_balance();
 
-  // calculate rvec, to do this need to reuse stacked vector for [f-m f-m f-m f-m]
-  perr = VecWAXPY(
-      *m_workspace->m_globaltmps[0], -1.0, *m_p_registered->global_vec(), *m_fixed.global_vec());
+  PetscErrorCode perr;
+  if (*m_workspace->m_scaled_lapl == nullptr)
+  {
+    perr = MatDuplicate(
+        *m_p_map->laplacian_root(), MAT_COPY_VALUES, m_workspace->m_scaled_lapl.get());
+    CHKERRABORT(m_comm, perr);
+    debug_creation(*m_workspace->m_scaled_lapl, "Mat_scaled_laplacian");
+  }
+  else
+  {
+    perr = MatCopy(
+        *m_p_map->laplacian_root(), *m_workspace->m_scaled_lapl, SAME_NONZERO_PATTERN);
+    CHKERRABORT(m_comm, perr);
+  }
+  perr = MatScale(*m_workspace->m_scaled_lapl, std::sqrt(lambda));
   CHKERRABORT(m_comm, perr);
-  m_workspace->duplicate_single_grad_to_stacked(0);
-  perr = MatMultTranspose(*m_workspace->m_tmat, *m_workspace->m_stacktmp, *m_workspace->m_rhs);
 
-  // Force free tmat as no longer needed
-  m_workspace->m_tmat = create_unique_mat();
+  // The pattern is fixed for the generation, after the first build only the values are copied
+  std::vector<Mat> lapl_blocks(m_mapdims, *m_workspace->m_scaled_lapl);
+  if (*m_workspace->m_augmented == nullptr)
+  {
+    // tmat is the basis tiled over the components, so the basis gives the same pattern
+    std::vector<Mat> blocks(m_mapdims, *m_p_map->basis());
+    blocks.insert(blocks.end(), lapl_blocks.cbegin(), lapl_blocks.cend());
+    intvector coltiles(2 * m_mapdims);
+    std::iota(coltiles.begin(), coltiles.begin() + m_mapdims, 0);
+    std::iota(coltiles.begin() + m_mapdims, coltiles.end(), 0);
+    stack_matrices(m_comm, blocks, coltiles, m_mapdims, m_workspace->m_augmented);
+    debug_creation(*m_workspace->m_augmented, "Mat_augmented");
+    perr = MatCreateVecs(*m_workspace->m_augmented, nullptr, m_workspace->m_augmented_rhs.get());
+    CHKERRABORT(m_comm, perr);
+  }
+  std::vector<Mat> sources(1, *m_workspace->m_tmat);
+  sources.insert(sources.end(), lapl_blocks.cbegin(), lapl_blocks.cend());
+  copy_stacked_values(m_comm, sources, *m_workspace->m_augmented);
 
-  // solve for delta a
-  KSP_unique m_ksp = create_unique_ksp();
-  perr = KSPCreate(m_comm, m_ksp.get());
+  // rank-local rows of T come first, so the rhs is the local residual followed by zeros
+  integer rsize, augsize;
+  perr = VecGetLocalSize(*m_workspace->m_stacktmp, &rsize);
   CHKERRABORT(m_comm, perr);
-  perr = KSPSetOperators(*m_ksp, *normmat, *normmat);
+  perr = VecGetLocalSize(*m_workspace->m_augmented_rhs, &augsize);
   CHKERRABORT(m_comm, perr);
-  perr = KSPSetUp(*m_ksp);
+
+  // T is block diagonal by component and S is constant on each component, so scaling the columns
+  // of T by S is scaling its luminance rows, which leaves the rows of L alone
+  Vec_shared rowscale = m_workspace->borrow_vec(*m_workspace->m_augmented_rhs);
+  floating* scaleptr;
+  perr = VecGetArray(*rowscale, &scaleptr);
   CHKERRABORT(m_comm, perr);
-  perr = KSPSetFromOptions(*m_ksp);
+  integer spt_end = spatial_local_size(rsize);
+  std::fill(scaleptr, scaleptr + spt_end, 1.);
+  std::fill(scaleptr + spt_end, scaleptr + rsize, lum_scale);
+  std::fill(scaleptr + rsize, scaleptr + augsize, 1.);
+  perr = VecRestoreArray(*rowscale, &scaleptr);
   CHKERRABORT(m_comm, perr);
-  perr = KSPSetUp(*m_ksp);
+  perr = MatDiagonalScale(*m_workspace->m_augmented, *rowscale, nullptr);
   CHKERRABORT(m_comm, perr);
-  perr = KSPSolve(*m_ksp, *m_workspace->m_rhs, *m_workspace->m_delta);
+  const floating* rptr;
+  floating* augptr;
+  perr = VecGetArrayRead(*m_workspace->m_stacktmp, &rptr);
+  CHKERRABORT(m_comm, perr);
+  perr = VecGetArray(*m_workspace->m_augmented_rhs, &augptr);
+  CHKERRABORT(m_comm, perr);
+  std::copy(rptr, rptr + rsize, augptr);
+  std::fill(augptr + rsize, augptr + augsize, 0.);
+  perr = VecRestoreArray(*m_workspace->m_augmented_rhs, &augptr);
+  CHKERRABORT(m_comm, perr);
+  perr = VecRestoreArrayRead(*m_workspace->m_stacktmp, &rptr);
   CHKERRABORT(m_comm, perr);
-  // update map
-  m_p_map->update(*m_workspace->m_delta);
-  // warp image
-  m_p_registered = m_p_map->warp(m_moved, *m_workspace);
-  m_p_registered->normalize();
+}
+
+void Elastic::recycled_guess(KSP ksp, const Mat& op, const Vec& rhs)
+{
+  // Start from the combination X c of earlier solutions minimising ||A X c - b|| for the current
+  // operator. A X is recomputed for every solve, so unlike PETSc's KSPGuess, which resets
+  // whenever the operator changes, the space stays useful as the normal matrix is rebuilt.
+  const std::deque<Vec_unique>& space = m_workspace->m_recycled;
+  size_t nvec = space.size();
+  PetscErrorCode perr = KSPSetInitialGuessNonzero(ksp, nvec > 0 ? PETSC_TRUE : PETSC_FALSE);
+  CHKERRABORT(m_comm, perr);
+  if (nvec == 0)
+  {
+    return;
+  }
+
+  profiling::ScopedPhase phase("recycle");
+  std::vector<Vec_shared> products;
+  for (const Vec_unique& sol : space)
+  {
+    products.push_back(m_workspace->borrow_vec(rhs));
+    perr = MatMult(op, *sol, *products.back());
+    CHKERRABORT(m_comm, perr);
+  }
+
+  // The small normal equations need every (A x_i).(A x_j) and b.(A x_i), reduced together
+  integer localsize;
+  perr = VecGetLocalSize(rhs, &localsize);
+  CHKERRABORT(m_comm, perr);
+  std::vector<const floating*> ptrs(nvec + 1);
+  for (size_t ivec = 0; ivec < nvec; ivec++)
+  {
+    perr = VecGetArrayRead(*products[ivec], &ptrs[ivec]);
+    CHKERRABORT(m_comm, perr);
+  }
+  perr = VecGetArrayRead(rhs, &ptrs[nvec]);
+  CHKERRABORT(m_comm, perr);
+  FusedReduction reduction(m_comm);
+  std::vector<size_t> dot_idx((nvec + 1) * nvec);
+  for (size_t ivec = 0; ivec <= nvec; ivec++)
+  {
+    for (size_t jvec = 0; jvec < std::min(ivec + 1, nvec); jvec++)
+    {
+      double dot = 0.;
+      for (integer idx = 0; idx < localsize; idx++)
+      {
+        dot += static_cast<double>(ptrs[ivec][idx]) * ptrs[jvec][idx];
+      }
+      dot_idx[ivec * nvec + jvec] = reduction.add_sum(dot);
+    }
+  }
+  perr = VecRestoreArrayRead(rhs, &ptrs[nvec]);
+  CHKERRABORT(m_comm, perr);
+  for (size_t ivec = 0; ivec < nvec; ivec++)
+  {
+    perr = VecRestoreArrayRead(*products[ivec], &ptrs[ivec]);
+    CHKERRABORT(m_comm, perr);
+  }
+  reduction.reduce();
+
+  floatvector gram(nvec * nvec), coeffs(nvec);
+  for (size_t ivec = 0; ivec < nvec; ivec++)
+  {
+    for (size_t jvec = 0; jvec <= ivec; jvec++)
+    {
+      gram[ivec * nvec + jvec] = reduction.result(dot_idx[ivec * nvec + jvec]);
+      gram[jvec * nvec + ivec] = gram[ivec * nvec + jvec];
+    }
+    coeffs[ivec] = reduction.result(dot_idx[nvec * nvec + ivec]);
+  }
+  solve_gram(gram, coeffs);
+
+  std::vector<Vec> sols;
+  for (const Vec_unique& sol : space)
+  {
+    sols.push_back(*sol);
+  }
+  perr = VecSet(*m_workspace->m_delta, 0.);
+  CHKERRABORT(m_comm, perr);
+  perr = VecMAXPY(*m_workspace->m_delta, nvec, coeffs.data(), sols.data());
+  CHKERRABORT(m_comm, perr);
+}
+
+void Elastic::recycle_solution()
+{
+  // Keep the raw solve output, before any column scaling or line search step is applied
+  std::deque<Vec_unique>& space = m_workspace->m_recycled;
+  Vec_unique sol = create_unique_vec();
+  PetscErrorCode perr;
+  if (static_cast<integer>(space.size()) >= m_krylov_recycle)
+  {
+    sol = std::move(space.front());
+    space.pop_front();
+  }
+  else
+  {
+    perr = VecDuplicate(*m_workspace->m_delta, sol.get());
+    CHKERRABORT(m_comm, perr);
+  }
+  perr = VecCopy(*m_workspace->m_delta, *sol);
+  CHKERRABORT(m_comm, perr);
+  space.push_back(std::move(sol));
+}
+
+void Elastic::autotune(const Mat& op, const Vec& rhs)
+{
+  // Time each candidate on the current system and keep the fastest that converges. The trial
+  // solves are thrown away, the chosen types are used for this and all later generations.
+  profiling::ScopedPhase phase("autotune");
+  std::vector<std::pair<std::string, std::string>> candidates = {{KSPGMRES, PCBJACOBI},
+      {KSPGMRES, PCASM}, {KSPGMRES, PCGAMG}, {KSPBCGS, PCBJACOBI}};
+  if (m_symmetric_scaling)
+  {
+    candidates.insert(candidates.begin(),
+        {{KSPCG, PCGAMG}, {KSPCG, PCBJACOBI}, {KSPCG, PCJACOBI}});
+  }
+
+  Vec_shared trial_sol = m_workspace->borrow_vec(*m_workspace->m_delta);
+  double best_time = std::numeric_limits<double>::max();
+  PetscPrintf(m_comm, "Autotuning linear solver:\n");
+  for (const auto& candidate : candidates)
+  {
+    KSP_unique trial = create_unique_ksp();
+    PetscErrorCode perr = KSPCreate(m_comm, trial.get());
+    CHKERRABORT(m_comm, perr);
+    perr = KSPSetOperators(*trial, op, op);
+    CHKERRABORT(m_comm, perr);
+    perr = KSPSetType(*trial, candidate.first.c_str());
+    CHKERRABORT(m_comm, perr);
+    PC pc;
+    perr = KSPGetPC(*trial, &pc);
+    CHKERRABORT(m_comm, perr);
+    perr = PCSetType(pc, candidate.second.c_str());
+    CHKERRABORT(m_comm, perr);
+    // a candidate that needs more than this is not going to be the fastest
+    perr = KSPSetTolerances(*trial, PETSC_DEFAULT, PETSC_DEFAULT, PETSC_DEFAULT, 1000);
+    CHKERRABORT(m_comm, perr);
+    perr = VecSet(*trial_sol, 0.);
+    CHKERRABORT(m_comm, perr);
+
+    auto tstart = std::chrono::steady_clock::now();
+    perr = KSPSetUp(*trial);
+    CHKERRABORT(m_comm, perr);
+    perr = KSPSolve(*trial, rhs, *trial_sol);
+    CHKERRABORT(m_comm, perr);
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - tstart).count();
+    // slowest rank decides, and every rank must agree on the choice
+    MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX, m_comm);
+
+    KSPConvergedReason reason;
+    perr = KSPGetConvergedReason(*trial, &reason);
+    CHKERRABORT(m_comm, perr);
+    integer its;
+    perr = KSPGetIterationNumber(*trial, &its);
+    CHKERRABORT(m_comm, perr);
+    PetscPrintf(m_comm, "  %s+%s: %s in %i iterations, %.4f s\n", candidate.first.c_str(),
+        candidate.second.c_str(), reason > 0 ? "converged" : "failed", its, elapsed);
+    profiling::add_count("autotune_trials");
+
+    if (reason > 0 && elapsed < best_time)
+    {
+      best_time = elapsed;
+      m_tuned_ksp = candidate.first;
+      m_tuned_pc = candidate.second;
+    }
+  }
+
+  if (m_tuned_ksp.empty())
+  {
+    PetscPrintf(m_comm, "No candidate converged, keeping default solver\n");
+    m_autotune = false;
+    return;
+  }
+  PetscPrintf(m_comm, "Selected %s+%s\n", m_tuned_ksp.c_str(), m_tuned_pc.c_str());
 }
 
 void Elastic::calculate_node_spacings()
@@ -193,6 +1068,7 @@ void Elastic::calculate_node_spacings()
 // iternum may be unused depending on debug level
 void Elastic::calculate_tmat(integer iternum __attribute__((unused)))
 {
+  profiling::ScopedPhase phase("tmat");
   // Calculate average intensity 0.5(f+m)
   // Constant offset needed later, does not affect gradients
   PetscErrorCode perr = VecSet(*m_workspace->m_globaltmps[m_fixed.ndim()], -1.0);
@@ -202,19 +1078,24 @@ void Elastic::calculate_tmat(integer iternum __attribute__((unused)))
       *m_fixed.global_vec(), *m_p_registered->global_vec());
   CHKERRABORT(PETSC_COMM_WORLD, perr);
 
-  // scatter this to local for later
+  // scatter this to local for the boundary gradients, the interior is computed meanwhile
   perr = DMGlobalToLocalBegin(*m_fixed.dmda(), *m_workspace->m_globaltmps[m_fixed.ndim()],
       INSERT_VALUES, *m_workspace->m_localtmp);
   CHKERRABORT(m_comm, perr);
+
+  // find average gradients
+  for (uinteger idim = 0; idim < m_fixed.ndim(); idim++)
+  {
+    fd::gradient_interior(*(m_fixed.dmda()), *m_workspace->m_globaltmps[m_fixed.ndim()],
+        *m_workspace->m_globaltmps[idim], idim);
+  }
+
   perr = DMGlobalToLocalEnd(*m_fixed.dmda(), *m_workspace->m_globaltmps[m_fixed.ndim()],
       INSERT_VALUES, *m_workspace->m_localtmp);
   CHKERRABORT(m_comm, perr);
-
-  // find average gradients
   for (uinteger idim = 0; idim < m_fixed.ndim(); idim++)
   {
-    // likely change this to avoid mallocs/frees
-    fd::gradient_existing(
+    fd::gradient_boundary(
         *(m_fixed.dmda()), *m_workspace->m_localtmp, *m_workspace->m_globaltmps[idim], idim);
   }
 
@@ -225,11 +1106,13 @@ void Elastic::calculate_tmat(integer iternum __attribute__((unused)))
   // scatter grads into stacked vector
   m_workspace->scatter_grads_to_stacked();
 
-  // 3. copy basis into p_tmat
-  m_workspace->m_tmat = create_unique_mat();
-  perr = MatDuplicate(*m_p_map->basis(), MAT_COPY_VALUES, m_workspace->m_tmat.get());
-  CHKERRABORT(m_comm, perr);
-  debug_creation(*m_workspace->m_tmat, std::string("Mat_tmat_") + std::to_string(iternum));
+  // 3. copy basis into p_tmat for every component, allocated once per generation
+  bool created = (*m_workspace->m_tmat == nullptr);
+  tile_matrix(m_comm, *m_p_map->basis(), m_mapdims, m_workspace->m_tmat);
+  if (created)
+  {
+    debug_creation(*m_workspace->m_tmat, std::string("Mat_tmat_") + std::to_string(iternum));
+  }
 
   // 4. left diagonal multiply p_tmat with stacked vector
   perr = MatDiagonalScale(*m_workspace->m_tmat, *m_workspace->m_stacktmp, nullptr);
@@ -239,24 +1122,18 @@ void Elastic::calculate_tmat(integer iternum __attribute__((unused)))
 void Elastic::block_precondition()
 {
   // Normalize luminance block of matrix to spatial blocks using diagonal norm
-  Vec_unique diag = create_unique_vec();
-  PetscErrorCode perr = MatCreateVecs(*normmat, diag.get(), nullptr);
-  CHKERRABORT(m_comm, perr);
-  debug_creation(*diag, "Vec_block_normalise");
-  perr = MatGetDiagonal(*normmat, *diag);
+  // rows of normmat share the layout of the map displacements
+  m_scaling = m_workspace->borrow_vec(*m_workspace->m_delta);
+  Vec_shared& diag = m_scaling;
+  PetscErrorCode perr = MatGetDiagonal(*normmat, *diag);
   CHKERRABORT(m_comm, perr);
 
-  // index where spatial dims stop and intensity dim starts
-  integer crit_idx = m_p_map->size() * m_p_map->m_ndim;
-
   // Find rank-local sums for spatial and luminance blocks
-  integer rowstart, rowend;
-  perr = VecGetOwnershipRange(*diag, &rowstart, &rowend);
+  integer localsize;
+  perr = VecGetLocalSize(*diag, &localsize);
   CHKERRABORT(m_comm, perr);
-  integer localsize = rowend - rowstart;
   floatvector norm(2, 0.0); // norm[0] is spatial, norm[1] is luminance
-  integer spt_end = crit_idx - rowstart;
-  spt_end = (spt_end < 0) ? 0 : (spt_end > localsize) ? localsize : spt_end;
+  integer spt_end = spatial_local_size(localsize);
 
   floating* ptr;
   perr = VecGetArray(*diag, &ptr);
@@ -273,29 +1150,227 @@ void Elastic::block_precondition()
   CHKERRABORT(m_comm, perr);
 
   // MPI_AllReduce to sum over all processes
-  MPI_Allreduce(MPI_IN_PLACE, norm.data(), 2, MPI_DOUBLE, MPI_SUM, m_comm);
+  MPI_Allreduce(MPI_IN_PLACE, norm.data(), 2, MPIU_SCALAR, MPI_SUM, m_comm);
+  profiling::add_count("global_reductions");
 
   // calculate average of norms and scaling factor
-  norm[0] /= crit_idx;
+  norm[0] /= m_p_map->size() * m_p_map->m_ndim;
   norm[1] /= m_p_map->size();
   floating lum_scale = norm[0] / norm[1];
+  // Scaling rows only breaks symmetry, scaling both sides by sqrt gives the same luminance block
+  if (m_symmetric_scaling)
+  {
+    lum_scale = std::sqrt(lum_scale);
+    profiling::add_count("symmetric_scalings");
+  }
 
   // reuse diag vector to hold scaling values
-  perr = VecGetArray(*diag, &ptr);
+  fill_block_scaling(lum_scale);
+
+  perr = MatDiagonalScale(*normmat, *diag, m_symmetric_scaling ? *diag : nullptr);
   CHKERRABORT(m_comm, perr);
-  for (integer idx = 0; idx < spt_end; idx++)
+}
+
+floating Elastic::column_balance()
+{
+  // Squared column norms of T are the diagonal of T^T T. T is block diagonal by component, so
+  // summing squared entries by stacked row gives the spatial and luminance totals without the
+  // global vector MatGetColumnNorms would allocate on every rank.
+  const Mat& tmat = *m_workspace->m_tmat;
+  integer rowstart, rowend;
+  PetscErrorCode perr = MatGetOwnershipRange(tmat, &rowstart, &rowend);
+  CHKERRABORT(m_comm, perr);
+  integer crit_row = rowstart + spatial_local_size(rowend - rowstart);
+  floatvector norm(2, 0.0); // norm[0] is spatial, norm[1] is luminance
+  for (integer row = rowstart; row < rowend; row++)
   {
-    ptr[idx] = 1;
+    integer ncols;
+    const floating* vals;
+    perr = MatGetRow(tmat, row, &ncols, nullptr, &vals);
+    CHKERRABORT(m_comm, perr);
+    floating& total = norm[row < crit_row ? 0 : 1];
+    for (integer idx = 0; idx < ncols; idx++)
+    {
+      total += vals[idx] * vals[idx];
+    }
+    perr = MatRestoreRow(tmat, row, &ncols, nullptr, &vals);
+    CHKERRABORT(m_comm, perr);
   }
-  for (integer idx = spt_end; idx < localsize; idx++)
+  MPI_Allreduce(MPI_IN_PLACE, norm.data(), 2, MPIU_SCALAR, MPI_SUM, m_comm);
+  profiling::add_count("global_reductions");
+
+  norm[0] /= m_p_map->size() * m_p_map->m_ndim;
+  norm[1] /= m_p_map->size();
+
+  // same balance as the symmetric scaling of the normal matrix, applied to the columns of the
+  // least squares operator
+  floating lum_scale = std::sqrt(norm[0] / norm[1]);
+  m_scaling = m_workspace->borrow_vec(*m_workspace->m_delta);
+  fill_block_scaling(lum_scale);
+  return lum_scale;
+}
+
+void Elastic::fill_block_scaling(floating lum_scale)
+{
+  integer localsize;
+  PetscErrorCode perr = VecGetLocalSize(*m_scaling, &localsize);
+  CHKERRABORT(m_comm, perr);
+  integer spt_end = spatial_local_size(localsize);
+
+  floating* ptr;
+  perr = VecGetArray(*m_scaling, &ptr);
+  CHKERRABORT(m_comm, perr);
+  std::fill(ptr, ptr + spt_end, 1.);
+  std::fill(ptr + spt_end, ptr + localsize, lum_scale);
+  perr = VecRestoreArray(*m_scaling, &ptr);
+  CHKERRABORT(m_comm, perr);
+}
+
+integer Elastic::spatial_local_size(integer localsize) const
+{
+  // Each rank stores all components of its nodes (or pixels) in turn, luminance last, so the
+  // spatial part of the local block is its leading m_imgdims components
+  return localsize / m_mapdims * m_imgdims;
+}
+
+void Elastic::setup_fieldsplit(KSP ksp)
+{
+  // Split the unknowns into the spatial displacements and the luminance correction, the index
+  // sets are fixed for the generation as is the KSP
+  integer rowstart, rowend;
+  PetscErrorCode perr = VecGetOwnershipRange(*m_workspace->m_delta, &rowstart, &rowend);
+  CHKERRABORT(m_comm, perr);
+  integer spt_end = rowstart + spatial_local_size(rowend - rowstart);
+
+  IS_unique spatial = create_unique_is();
+  perr = ISCreateStride(m_comm, spt_end - rowstart, rowstart, 1, spatial.get());
+  CHKERRABORT(m_comm, perr);
+  IS_unique luminance = create_unique_is();
+  perr = ISCreateStride(m_comm, rowend - spt_end, spt_end, 1, luminance.get());
+  CHKERRABORT(m_comm, perr);
+
+  PC pc;
+  perr = KSPGetPC(ksp, &pc);
+  CHKERRABORT(m_comm, perr);
+  perr = PCSetType(pc, PCFIELDSPLIT);
+  CHKERRABORT(m_comm, perr);
+  // PC keeps its own references to the index sets
+  perr = PCFieldSplitSetIS(pc, "spatial", *spatial);
+  CHKERRABORT(m_comm, perr);
+  perr = PCFieldSplitSetIS(pc, "luminance", *luminance);
+  CHKERRABORT(m_comm, perr);
+
+  PCCompositeType type = PC_COMPOSITE_MULTIPLICATIVE;
+  if (m_fieldsplit == "additive")
   {
-    ptr[idx] = lum_scale;
+    type = PC_COMPOSITE_ADDITIVE;
   }
-  perr = VecRestoreArray(*diag, &ptr);
+  else if (m_fieldsplit == "symmetric_multiplicative")
+  {
+    type = PC_COMPOSITE_SYMMETRIC_MULTIPLICATIVE;
+  }
+  else if (m_fieldsplit == "schur")
+  {
+    type = PC_COMPOSITE_SCHUR;
+  }
+  perr = PCFieldSplitSetType(pc, type);
+  CHKERRABORT(m_comm, perr);
+}
+
+void Elastic::setup_sub_solvers(KSP ksp)
+{
+  // The nested solvers of fieldsplit and telescope only exist once the outer PC is set up
+  PC pc;
+  PetscErrorCode perr = KSPGetPC(ksp, &pc);
+  CHKERRABORT(m_comm, perr);
+  PetscBool fieldsplit, telescope;
+  perr = PetscObjectTypeCompare(reinterpret_cast<PetscObject>(pc), PCFIELDSPLIT, &fieldsplit);
+  CHKERRABORT(m_comm, perr);
+  perr = PetscObjectTypeCompare(reinterpret_cast<PetscObject>(pc), PCTELESCOPE, &telescope);
+  CHKERRABORT(m_comm, perr);
+
+  if (fieldsplit)
+  {
+    // Multigrid suits the elliptic spatial block, the luminance block is close to diagonal.
+    // Only defaults, anything set with -fieldsplit_<name>_ options wins.
+    integer nsplits;
+    KSP* subksps;
+    perr = PCFieldSplitGetSubKSP(pc, &nsplits, &subksps);
+    CHKERRABORT(m_comm, perr);
+    set_sub_solver_default(m_comm, subksps[0], nullptr, PCGAMG);
+    set_sub_solver_default(m_comm, subksps[1], nullptr, PCJACOBI);
+    perr = PetscFree(subksps);
+    CHKERRABORT(m_comm, perr);
+  }
+  else if (telescope)
+  {
+    // only ranks in the reduced communicator have the inner solver
+    KSP subksp;
+    perr = PCTelescopeGetKSP(pc, &subksp);
+    CHKERRABORT(m_comm, perr);
+    if (subksp != nullptr)
+    {
+      set_sub_solver_default(m_comm, subksp, KSPPREONLY, PCLU);
+    }
+  }
+}
+
+bool Elastic::setup_direct_solve(KSP ksp)
+{
+  // Coarse generations have too few unknowns to be worth a distributed Krylov solve, factor them
+  // instead. Anything the user chose explicitly is left alone.
+  integer unknowns;
+  PetscErrorCode perr = VecGetSize(*m_workspace->m_delta, &unknowns);
+  CHKERRABORT(m_comm, perr);
+  PetscBool ksp_set, pc_set;
+  perr = PetscOptionsHasName(nullptr, nullptr, "-ksp_type", &ksp_set);
   CHKERRABORT(m_comm, perr);
+  perr = PetscOptionsHasName(nullptr, nullptr, "-pc_type", &pc_set);
+  CHKERRABORT(m_comm, perr);
+  if (unknowns > m_direct_solve_size || m_solver != "normal" || m_fieldsplit != "none" || ksp_set
+      || pc_set || !m_tuned_ksp.empty())
+  {
+    return false;
+  }
 
-  perr = MatDiagonalScale(*normmat, *diag, nullptr);
+  perr = KSPSetType(ksp, KSPPREONLY);
+  CHKERRABORT(m_comm, perr);
+  PC pc;
+  perr = KSPGetPC(ksp, &pc);
   CHKERRABORT(m_comm, perr);
+  int comm_size;
+  MPI_Comm_size(m_comm, &comm_size);
+#if defined(PETSC_HAVE_MUMPS) || defined(PETSC_HAVE_SUPERLU_DIST)
+  perr = PCSetType(pc, PCLU);
+  CHKERRABORT(m_comm, perr);
+#if defined(PETSC_HAVE_MUMPS)
+  perr = PCFactorSetMatSolverType(pc, MATSOLVERMUMPS);
+#else
+  perr = PCFactorSetMatSolverType(pc, MATSOLVERSUPERLU_DIST);
+#endif
+  CHKERRABORT(m_comm, perr);
+  const char* method = "distributed LU";
+#else
+  // PETSc's own LU is serial only, so gather the system onto a single rank to factor it
+  const char* method = "LU";
+  if (comm_size == 1)
+  {
+    perr = PCSetType(pc, PCLU);
+    CHKERRABORT(m_comm, perr);
+  }
+  else
+  {
+    perr = PCSetType(pc, PCTELESCOPE);
+    CHKERRABORT(m_comm, perr);
+    perr = PCTelescopeSetReductionFactor(pc, comm_size);
+    CHKERRABORT(m_comm, perr);
+    // the gathered system is factored by the inner solver, see setup_sub_solvers
+    method = "LU on one rank";
+  }
+#endif
+  PetscPrintf(m_comm, "Using direct solve (%s) for %i unknowns\n", method, unknowns);
+  profiling::add_count("direct_solves");
+  return true;
 }
 
 void Elastic::save_debug_frame(std::string prefix, integer outer_count, integer inner_count)
@@ -18,8 +18,10 @@
 
 #include <algorithm>
 #include <iostream>
+#include <string>
 
 #include <petscdmda.h>
+#include <petscksp.h>
 #include <petscmat.h>
 
 #include "types.hpp"
@@ -44,6 +46,37 @@ public:
 
   integer m_max_iter = 50;
   floating m_convergence_thres = 0.1;
+  bool m_compositional = false;
+  bool m_symmetric_scaling = false;
+  std::string m_fieldsplit = "none";
+  std::string m_solver = "normal";
+  integer m_direct_solve_size = 5000;
+  bool m_autotune = false;
+  integer m_krylov_recycle = 0;
+  // Recycling is off for direct solves, decided when each generation's KSP is created
+  bool m_recycling = false;
+  // Normal matrix is rebuilt every m_operator_lag iterations, or when the residual reduction
+  // falls below m_stall_ratio
+  integer m_operator_lag = 1;
+  floating m_stall_ratio = 0.9;
+  integer m_lag_count = 0;
+  floating m_prev_phi = -1;
+  // KSP and PC types picked by autotune, empty until it has run
+  std::string m_tuned_ksp, m_tuned_pc;
+  bool m_line_search = false;
+  integer m_max_backtracks = 5;
+  bool m_inexact_newton = false;
+  // Eisenstat-Walker state, reset at the start of each generation
+  floating m_ew_prev_norm = -1;
+  floating m_ew_prev_rtol = 0.3;
+  // Data term and largest update of the last step, from the reduction in apply_update. The data
+  // term is only valid while the registered image is in the recorded state.
+  floating m_phi = -1;
+  Vec m_phi_vec = nullptr;
+  PetscObjectState m_phi_state = 0;
+  floating m_max_delta = 0;
+  // Squared norm of the fixed image, constant so reduced once
+  double m_fixed_norm2 = -1;
 
   // Straightforward initialize-by-copy
   MPI_Comm m_comm;
@@ -62,12 +95,34 @@ public:
   std::unique_ptr<Map> m_p_map;
   std::shared_ptr<WorkSpace> m_workspace;
   Mat_unique normmat;
+  // Diagonal block scaling of the current normal matrix, held for as long as the matrix is used
+  Vec_shared m_scaling;
 
   void save_debug_frame(std::string prefix, integer ocount, integer icount);
   void innerloop(integer outer_count);
-  void innerstep(floating lambda, integer inum);
+  config_map generation_options(integer generation) const;
+  // False if the line search found no acceptable step and the map was left unchanged
+  bool innerstep(floating lambda, integer inum);
+  void assemble_normal_system(floating lambda, integer inum);
+  void assemble_normal_rhs();
+  bool operator_outdated(floating phi);
+  void assemble_least_squares(floating lambda);
+  floating residual_norm2();
+  floating forcing_term();
+  void apply_update();
+  void reduce_update();
+  bool line_search(floating phi0);
 
   void block_precondition();
+  floating column_balance();
+  void fill_block_scaling(floating lum_scale);
+  integer spatial_local_size(integer localsize) const;
+  void setup_fieldsplit(KSP ksp);
+  void setup_sub_solvers(KSP ksp);
+  bool setup_direct_solve(KSP ksp);
+  void autotune(const Mat& op, const Vec& rhs);
+  void recycled_guess(KSP ksp, const Mat& op, const Vec& rhs);
+  void recycle_solution();
   void calculate_node_spacings();
   void calculate_tmat(integer inum);
 };
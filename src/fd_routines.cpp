@@ -15,6 +15,41 @@
 
 #include "fd_routines.hpp"
 
+#include <algorithm>
+#include <functional>
+#include <tuple>
+
+namespace
+{
+// Central difference along ofs for the points in [lo, hi), arrays indexed [k][j][i]
+void central_difference(floating ***img_array, floating ***grad_array, const intvector &lo,
+    const intvector &hi, const intvector &ofs)
+{
+  for (integer i = lo[0]; i < hi[0]; i++)
+  {
+    for (integer j = lo[1]; j < hi[1]; j++)
+    {
+      for (integer k = lo[2]; k < hi[2]; k++)
+      {
+        grad_array[k][j][i] = 0.5
+                              * (img_array[k + ofs[2]][j + ofs[1]][i + ofs[0]]
+                                 - img_array[k - ofs[2]][j - ofs[1]][i - ofs[0]]);
+      }
+    }
+  }
+}
+
+std::pair<intvector, intvector> owned_corners(const DM &dmda)
+{
+  intvector lo(3, 0), hi(3, 0);
+  // This returns corners + widths so add lo to get hi
+  PetscErrorCode perr = DMDAGetCorners(dmda, &lo[0], &lo[1], &lo[2], &hi[0], &hi[1], &hi[2]);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+  std::transform(hi.cbegin(), hi.cend(), lo.cbegin(), hi.begin(), std::plus<>());
+  return std::make_pair(lo, hi);
+}
+} // anonymous namespace
+
 Vec_unique fd::gradient_to_global_unique(const DM &dmda, const Vec &localvec, integer dim)
 {
   //  First sanity check we have a valid local vector for the DMDA
@@ -127,3 +162,66 @@ void fd::gradient_existing(const DM &dmda, const Vec &srcvec, Vec &tgtvec, integ
   perr = DMDAVecRestoreArray(dmda, tgtvec, &grad_array);
   CHKERRABORT(PETSC_COMM_WORLD, perr);
 }
+
+void fd::gradient_interior(const DM &dmda, const Vec &globalsrc, Vec &tgtvec, integer dim)
+{
+  intvector lo, hi;
+  std::tie(lo, hi) = owned_corners(dmda);
+  lo[dim] += 1;
+  hi[dim] -= 1;
+  if (lo[dim] >= hi[dim])
+  {
+    return;
+  }
+
+  // Global arrays are indexed over the owned block only, which is all the interior needs. Only
+  // read access so the exchange reading globalsrc is unaffected.
+  floating ***img_array, ***grad_array;
+  PetscErrorCode perr = DMDAVecGetArrayRead(dmda, globalsrc, &img_array);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+  perr = DMDAVecGetArray(dmda, tgtvec, &grad_array);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+
+  intvector ofs = {0, 0, 0};
+  ofs[dim] = 1;
+  central_difference(img_array, grad_array, lo, hi, ofs);
+
+  perr = DMDAVecRestoreArrayRead(dmda, globalsrc, &img_array);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+  perr = DMDAVecRestoreArray(dmda, tgtvec, &grad_array);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+}
+
+void fd::gradient_boundary(const DM &dmda, const Vec &localsrc, Vec &tgtvec, integer dim)
+{
+  intvector lo, hi;
+  std::tie(lo, hi) = owned_corners(dmda);
+  if (lo[dim] >= hi[dim])
+  {
+    return;
+  }
+
+  floating ***img_array, ***grad_array;
+  PetscErrorCode perr = DMDAVecGetArrayRead(dmda, localsrc, &img_array);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+  perr = DMDAVecGetArray(dmda, tgtvec, &grad_array);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+
+  intvector ofs = {0, 0, 0};
+  ofs[dim] = 1;
+  // First owned layer along dim, then the last if it is a different one
+  intvector face_hi = hi;
+  face_hi[dim] = lo[dim] + 1;
+  central_difference(img_array, grad_array, lo, face_hi, ofs);
+  if (hi[dim] - 1 > lo[dim])
+  {
+    intvector face_lo = lo;
+    face_lo[dim] = hi[dim] - 1;
+    central_difference(img_array, grad_array, face_lo, hi, ofs);
+  }
+
+  perr = DMDAVecRestoreArrayRead(dmda, localsrc, &img_array);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+  perr = DMDAVecRestoreArray(dmda, tgtvec, &grad_array);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+}
@@ -31,6 +31,13 @@ Vec_unique gradient_to_global_unique(const DM &dmda, const Vec &localvec, intege
 
 void gradient_existing(const DM &dmda, const Vec &src, Vec &tgt, integer dim);
 
+// Split form of gradient_existing so the ghost exchange can be overlapped. The interior points
+// along dim only need owned values, so gradient_interior reads them from the global vector and
+// can run between DMGlobalToLocalBegin and End. gradient_boundary then fills the first and last
+// owned layer along dim from the ghosted local vector.
+void gradient_interior(const DM &dmda, const Vec &globalsrc, Vec &tgt, integer dim);
+void gradient_boundary(const DM &dmda, const Vec &localsrc, Vec &tgt, integer dim);
+
 } // namespace fd
 
 #endif
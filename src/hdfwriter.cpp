@@ -16,6 +16,7 @@
 #include "hdfwriter.hpp"
 
 #include <algorithm>
+#include <numeric>
 #include <sstream>
 
 #include "image.hpp"
@@ -114,6 +115,15 @@ void HDFWriter::write_map(const Map& map)
     throw std::runtime_error(errstr.str());
   }
 
+  // Gather every component at once, each rank's block of component idx starts at idx*blocksize
+  auto corners = map.get_dmda_local_extents();
+  integer blocksize = std::accumulate(
+      corners.second.cbegin(), corners.second.cend(), 1, std::multiplies<>());
+  Vec_unique mapvec = map.get_spatial_data_dmda_blocked();
+  const floating* mapdata;
+  PetscErrorCode perr = VecGetArrayRead(*mapvec, &mapdata);
+  CHKERRABORT(_comm, perr);
+
   for (uinteger idx = 0; idx < map.ndim(); idx++)
   {
     // Maps contained in group
@@ -126,10 +136,8 @@ void HDFWriter::write_map(const Map& map)
     hid_t dset_h = H5Dcreate(_file_h, dsetname.c_str(), H5T_NATIVE_DOUBLE, fspace_h, H5P_DEFAULT,
         H5P_DEFAULT, H5P_DEFAULT);
 
-    auto corners = map.get_dmda_local_extents();
     std::vector<hsize_t> offset(corners.first.cbegin(), corners.first.cend());
     std::vector<hsize_t> chunksize(corners.second.cbegin(), corners.second.cend());
-    Vec_unique dimdata = map.get_dim_data_dmda_blocked(idx);
 
     std::ostringstream ofs;
     std::copy(offset.cbegin(), offset.cend(), infix_ostream_iterator<integer>(ofs, ", "));
@@ -147,16 +155,14 @@ void HDFWriter::write_map(const Map& map)
 
     hid_t dspace_h = H5Screate_simple(map.ndim(), chunksize.data(), nullptr);
 
-    const floating* mapdata;
-    PetscErrorCode perr = VecGetArrayRead(*dimdata, &mapdata);
-    CHKERRABORT(_comm, perr);
-    H5Dwrite(dset_h, H5T_NATIVE_DOUBLE, dspace_h, fspace_h, plist_h, mapdata);
-    perr = VecRestoreArrayRead(*dimdata, &mapdata);
+    H5Dwrite(dset_h, H5T_NATIVE_DOUBLE, dspace_h, fspace_h, plist_h, mapdata + idx * blocksize);
 
     H5Dclose(dset_h);
     H5Sclose(fspace_h);
     H5Sclose(dspace_h);
   }
+  perr = VecRestoreArrayRead(*mapvec, &mapdata);
+  CHKERRABORT(_comm, perr);
   H5Gclose(mgroup_h);
   H5Pclose(plist_h);
 }
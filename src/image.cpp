@@ -23,6 +23,7 @@
 #include <petscdmda.h>
 #include <petscvec.h>
 
+#include "decomposition.hpp"
 #include "fd_routines.hpp"
 #include "iterator_routines.hpp"
 #include "map.hpp"
@@ -120,11 +121,16 @@ Image::load_file(const std::string& path, const Image* existing, MPI_Comm comm)
 // Return scale factor
 floating Image::normalize()
 {
-  floating norm;
-  PetscErrorCode perr = VecSum(*m_globalvec, &norm);
+  floating sum;
+  PetscErrorCode perr = VecSum(*m_globalvec, &sum);
   CHKERRABORT(m_comm, perr);
-  norm = this->size() / norm;
-  perr = VecScale(*m_globalvec, norm);
+  return normalize_with_sum(sum);
+}
+
+floating Image::normalize_with_sum(floating sum)
+{
+  floating norm = this->size() / sum;
+  PetscErrorCode perr = VecScale(*m_globalvec, norm);
   CHKERRABORT(m_comm, perr);
   return norm;
 }
@@ -170,15 +176,17 @@ void Image::initialize_dmda()
   integer stencil_width = 1;
   PetscErrorCode perr;
 
+  decomposition::GridPartition part = decomposition::image_partition(m_shape, m_comm);
+
   // Make sure things get gracefully cleaned up
   m_dmda = create_shared_dm();
   perr = DMDACreate3d(
       m_comm, DM_BOUNDARY_GHOSTED, DM_BOUNDARY_GHOSTED, DM_BOUNDARY_GHOSTED, // BCs
       DMDA_STENCIL_STAR,                                                     // stencil shape
       m_shape[0], m_shape[1], m_shape[2],                                    // global mesh shape
-      PETSC_DECIDE, PETSC_DECIDE, PETSC_DECIDE,                              // ranks per dim
+      part.procs[0], part.procs[1], part.procs[2],                           // ranks per dim
       dof_per_node, stencil_width, // dof per node, stencil size
-      nullptr, nullptr, nullptr,   // partition sizes nullptr -> petsc chooses
+      part.ownership_ptr(0), part.ownership_ptr(1), part.ownership_ptr(2), // nullptr -> petsc
       m_dmda.get());
   CHKERRABORT(m_comm, perr);
 
@@ -210,16 +218,19 @@ void Image::update_local_from_global()
 Vec_unique Image::gradient(integer dim)
 {
   // New global vec must be a duplicate of image global
-  Vec_shared grad = create_shared_vec();
+  Vec_unique grad = create_unique_vec();
   PetscErrorCode perr = VecDuplicate(*(m_globalvec), grad.get());
   CHKERRABORT(m_comm, perr);
 
-  // Ensure we have up to date ghost cells
-  DMGlobalToLocalBegin(*m_dmda, *m_globalvec, INSERT_VALUES, *m_localvec);
-  // Nothing really useful to interleave
-  DMGlobalToLocalEnd(*m_dmda, *m_globalvec, INSERT_VALUES, *m_localvec);
+  // Ensure we have up to date ghost cells, interior points don't need them
+  perr = DMGlobalToLocalBegin(*m_dmda, *m_globalvec, INSERT_VALUES, *m_localvec);
+  CHKERRABORT(m_comm, perr);
+  fd::gradient_interior(*m_dmda, *m_globalvec, *grad, dim);
+  perr = DMGlobalToLocalEnd(*m_dmda, *m_globalvec, INSERT_VALUES, *m_localvec);
+  CHKERRABORT(m_comm, perr);
+  fd::gradient_boundary(*m_dmda, *m_localvec, *grad, dim);
 
-  return fd::gradient_to_global_unique(*m_dmda, *m_localvec, dim);
+  return grad;
 }
 
 Vec_unique Image::scatter_to_zero(Vec& vec) const
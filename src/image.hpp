@@ -69,6 +69,8 @@ public:
   Vec_unique get_raw_data_row_major() const;
 
   floating normalize();
+  // As normalize, for when the global sum of the data is already known
+  floating normalize_with_sum(floating sum);
 
   template <typename inttype>
   std::vector<inttype> mpi_get_offset() const;
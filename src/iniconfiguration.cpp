@@ -112,7 +112,18 @@ void IniConfig::read_config_file(const std::string &config_path)
   for (const auto &it : config_data)
   {
     std::string key = ba::to_lower_copy(it.first);
-    if (std::find(arg_options.cbegin(), arg_options.cend(), key) != arg_options.cend())
+    if (key == "petsc" || key.compare(0, 6, "petsc.") == 0)
+    {
+      // PETSc option names are case sensitive so only the section name is lowered
+      for (const auto &opt : it.second)
+      {
+        if (!add_petsc_option(key, opt.first, opt.second.data()))
+        {
+          unknowns.push_back(key + "." + opt.first);
+        }
+      }
+    }
+    else if (std::find(arg_options.cbegin(), arg_options.cend(), key) != arg_options.cend())
     {
       config[key] = it.second.data();
     }
@@ -15,21 +15,28 @@
 
 #include "map.hpp"
 
+#include <tuple>
+
 #include <petscvec.h>
 
 #include "basis.hpp"
+#include "decomposition.hpp"
 #include "image.hpp"
 #include "indexing.hpp"
 #include "laplacian.hpp"
+#include "petsc_helpers.hpp"
+#include "profiling.hpp"
 #include "workspace.hpp"
 
 #include "iterator_routines.hpp"
 
-Map::Map(const Image& mask, const floatvector& node_spacing)
+Map::Map(const Image& mask, const floatvector& node_spacing, BasisType basis_type)
     : m_comm(mask.comm()), m_mask(mask), m_ndim(mask.ndim()), m_v_node_spacing(node_spacing),
-      m_v_offsets(floatvector()), m_v_image_shape(mask.shape()), map_shape(intvector()),
-      m_vv_node_locs(floatvector2d()), m_basis(create_unique_mat()), m_lapl(create_unique_mat()),
-      m_displacements(create_unique_vec()), map_dmda(create_unique_dm())
+      m_basis_type(basis_type), m_v_offsets(floatvector()), m_v_image_shape(mask.shape()),
+      map_shape(intvector()), m_vv_node_locs(floatvector2d()), m_basis(create_unique_mat()),
+      m_tiled_basis(create_unique_mat()), m_lapl(create_unique_mat()),
+      m_lapl_root(create_unique_mat()), m_displacements(create_unique_vec()),
+      m_node_ranges(intvector()), map_dmda(create_unique_dm())
 {
   calculate_node_locs();
   calculate_basis();
@@ -45,9 +52,78 @@ void Map::update(const Vec& delta_vec)
   CHKERRABORT(m_comm, perr);
 }
 
+void Map::compose(const Vec& delta_vec)
+{
+  // Warping the registered image by delta gives moved(x + delta(x) + d(x + delta(x))), so the
+  // composed map is delta(x) + d(x + delta(x)). Luminance remains additive.
+  if (m_basis_type != BasisType::linear)
+  {
+    throw std::runtime_error("map composition is only valid for the linear basis");
+  }
+  profiling::ScopedPhase phase("compose");
+  integer nodestart, nodeend;
+  std::tie(nodestart, nodeend) = get_node_ownershiprange();
+  integer nlocal = nodeend - nodestart;
+  integer ntiles = m_ndim + 1;
+
+  // Each rank holds every component of delta at its own nodes, so the displaced node positions
+  // (in node units) come straight from the local array
+  intvector map_shape_trunc(map_shape.cbegin(), map_shape.cbegin() + m_ndim);
+  floatvector2d coords(nlocal, floatvector(m_ndim, 0.));
+  const floating* dptr;
+  PetscErrorCode perr = VecGetArrayRead(delta_vec, &dptr);
+  CHKERRABORT(m_comm, perr);
+  for (integer row = 0; row < nlocal; row++)
+  {
+    intvector node = unravel(nodestart + row, map_shape_trunc);
+    for (uinteger idim = 0; idim < m_ndim; idim++)
+    {
+      coords[row][idim] = node[idim] + dptr[idim * nlocal + row] / m_v_node_spacing[idim];
+    }
+  }
+  perr = VecRestoreArrayRead(delta_vec, &dptr);
+  CHKERRABORT(m_comm, perr);
+
+  Mat_unique resample = build_resample_matrix(m_comm, map_shape, m_ndim, coords);
+
+  // d_new = R d + delta for the spatial components, d + delta for luminance
+  Vec_unique composed = create_unique_vec();
+  perr = VecDuplicate(*m_displacements, composed.get());
+  CHKERRABORT(m_comm, perr);
+  debug_creation(*composed, "Vec_composed_displacements");
+  perr = VecCopy(delta_vec, *composed);
+  CHKERRABORT(m_comm, perr);
+  for (integer tile = 0; tile < ntiles; tile++)
+  {
+    IS_unique component = create_unique_is();
+    perr = ISCreateStride(m_comm, nlocal, stacked_index(nodestart, tile), 1, component.get());
+    CHKERRABORT(m_comm, perr);
+    Vec src, tgt;
+    perr = VecGetSubVector(*m_displacements, *component, &src);
+    CHKERRABORT(m_comm, perr);
+    perr = VecGetSubVector(*composed, *component, &tgt);
+    CHKERRABORT(m_comm, perr);
+    if (tile < static_cast<integer>(m_ndim))
+    {
+      perr = MatMultAdd(*resample, src, tgt, tgt);
+    }
+    else
+    {
+      perr = VecAXPY(tgt, 1., src);
+    }
+    CHKERRABORT(m_comm, perr);
+    perr = VecRestoreSubVector(*composed, *component, &tgt);
+    CHKERRABORT(m_comm, perr);
+    perr = VecRestoreSubVector(*m_displacements, *component, &src);
+    CHKERRABORT(m_comm, perr);
+  }
+  std::swap(m_displacements, composed);
+}
+
 std::unique_ptr<Map> Map::interpolate(const floatvector& new_spacing)
 {
-  std::unique_ptr<Map> new_map(new Map(this->m_mask, new_spacing));
+  profiling::ScopedPhase phase("interpolate");
+  std::unique_ptr<Map> new_map(new Map(this->m_mask, new_spacing, m_basis_type));
 
   floatvector scalings(m_ndim, 0.0);
   floatvector offsets(m_ndim, 0.0);
@@ -60,10 +136,14 @@ std::unique_ptr<Map> Map::interpolate(const floatvector& new_spacing)
       new_map->m_v_offsets.begin(), new_map->m_v_offsets.end(), this->m_v_offsets.begin(),
       this->m_v_node_spacing.begin());
 
-  Mat_unique interp = build_basis_matrix(
-      m_comm, map_shape, new_map->map_shape, scalings, offsets, m_ndim, m_ndim + 1);
+  // Halving the spacing has an exact B-spline refinement, other changes resample the basis
+  bool dyadic = std::all_of(scalings.cbegin(), scalings.cend(),
+      [](floating a) -> bool { return std::abs(a - 0.5) < 1e-6; });
+  Mat_unique interp = build_basis_matrix(m_comm, map_shape, new_map->map_shape, scalings,
+      offsets, m_ndim, 1, m_basis_type, dyadic && m_basis_type == BasisType::cubic);
+  Mat_unique tiled_interp = create_tiled_operator(m_comm, *interp, m_ndim + 1);
 
-  PetscErrorCode perr = MatMult(*interp, *m_displacements, *new_map->m_displacements);
+  PetscErrorCode perr = MatMult(*tiled_interp, *m_displacements, *new_map->m_displacements);
   CHKERRABORT(m_comm, perr);
 
   return new_map;
@@ -81,14 +161,16 @@ void Map::initialize_dmda() const
   integer stencil_width = 1;
   PetscErrorCode perr;
 
+  decomposition::GridPartition part = decomposition::map_partition(map_shape, m_comm);
+
   // Make sure things get gracefully cleaned up
   perr = DMDACreate3d(
       m_comm, DM_BOUNDARY_NONE, DM_BOUNDARY_NONE, DM_BOUNDARY_NONE, // BCs
       DMDA_STENCIL_STAR,                                            // stencil shape
       map_shape[0], map_shape[1], map_shape[2],                     // global mesh shape
-      PETSC_DECIDE, PETSC_DECIDE, PETSC_DECIDE,                     // ranks per dim
+      part.procs[0], part.procs[1], part.procs[2],                  // ranks per dim
       dof_per_node, stencil_width,                                  // dof per node, stencil size
-      nullptr, nullptr, nullptr, // partition sizes nullptr -> petsc chooses
+      part.ownership_ptr(0), part.ownership_ptr(1), part.ownership_ptr(2), // nullptr -> petsc
       map_dmda.get());
   CHKERRABORT(m_comm, perr);
 
@@ -98,7 +180,11 @@ void Map::initialize_dmda() const
 
 void Map::alloc_displacements()
 {
-  MatCreateVecs(*m_basis, m_displacements.get(), nullptr);
+  // one basis column per node, all components of a node on the same rank
+  Vec_unique nodes = create_unique_vec();
+  PetscErrorCode perr = MatCreateVecs(*m_basis, nodes.get(), nullptr);
+  CHKERRABORT(m_comm, perr);
+  m_displacements = create_tiled_vec(m_comm, *nodes, m_ndim + 1);
 }
 
 intvector Map::calculate_map_shape(intvector const& image_shape, floatvector const& nodespacing)
@@ -140,44 +226,35 @@ void Map::calculate_node_locs()
 std::unique_ptr<Image> Map::warp(const Image& image, WorkSpace& wksp)
 {
   // TODO: Check image is compatible
+  profiling::ScopedPhase phase("warp");
 
   // interpolate map to image nodes with basis
-  PetscErrorCode perr = MatMult(*m_basis, *m_displacements, *wksp.m_stacktmp);
+  PetscErrorCode perr = MatMult(*m_tiled_basis, *m_displacements, *wksp.m_stacktmp);
   CHKERRABORT(m_comm, perr);
   wksp.scatter_stacked_to_grads();
 
-  // build warp matrix
   std::vector<Vec*> tmps(0);
   for (auto const& vptr : wksp.m_globaltmps)
   {
     tmps.push_back(vptr.get());
   }
-  Mat_unique warp = build_warp_matrix(m_comm, m_v_image_shape, image.ndim(), tmps);
-
-  // now apply matrix to get new image data
-  // first need image in natural ordering
-  Vec_unique src_nat = create_unique_vec();
-  perr = DMDACreateNaturalVector(*image.dmda(), src_nat.get());
-  CHKERRABORT(m_comm, perr);
-  debug_creation(*src_nat, "Vec_source_natural");
-  perr = DMDAGlobalToNaturalBegin(*image.dmda(), *image.global_vec(), INSERT_VALUES, *src_nat);
-  CHKERRABORT(m_comm, perr);
-  perr = DMDAGlobalToNaturalEnd(*image.dmda(), *image.global_vec(), INSERT_VALUES, *src_nat);
-  CHKERRABORT(m_comm, perr);
-  // do mult
-  Vec_unique tgt_nat = create_unique_vec();
-  perr = DMDACreateNaturalVector(*image.dmda(), tgt_nat.get());
-  CHKERRABORT(m_comm, perr);
-  debug_creation(*tgt_nat, "Vec_target_natural");
-  perr = MatMult(*warp, *src_nat, *tgt_nat);
-  CHKERRABORT(m_comm, perr);
+  if (wksp.m_warp_interpolation == WarpInterpolation::sinc)
+  {
+    profiling::add_count("sinc_warps");
+  }
 
-  // create new image and insert data in petsc ordering
+  // sample directly from the ghosted image unless the displacements reach beyond any halo
   std::unique_ptr<Image> new_image = image.duplicate();
-  perr =
-      DMDANaturalToGlobalBegin(*image.dmda(), *tgt_nat, INSERT_VALUES, *new_image->global_vec());
-  CHKERRABORT(m_comm, perr);
-  perr = DMDANaturalToGlobalEnd(*image.dmda(), *tgt_nat, INSERT_VALUES, *new_image->global_vec());
+  if (wksp.warp_halo(image, tmps, *new_image->global_vec()))
+  {
+    return new_image;
+  }
+
+  // warp matrix is in PETSc ordering so applies directly to the global vectors
+  profiling::add_count("matrix_warps");
+  Mat_unique warp = build_warp_matrix(
+      m_comm, *image.dmda(), m_v_image_shape, image.ndim(), tmps, wksp.m_warp_interpolation);
+  perr = MatMult(*warp, wksp.warp_source(image), *new_image->global_vec());
   CHKERRABORT(m_comm, perr);
   return new_image;
 }
@@ -197,39 +274,73 @@ std::pair<intvector, intvector> Map::get_dmda_local_extents() const
 
 Vec_unique Map::get_dim_data_dmda_blocked(uinteger dim) const
 {
-  initialize_dmda();
   if (dim >= m_ndim)
   {
     throw std::runtime_error("Index too large for map dimensions");
   }
+  return gather_dmda_blocked(dim, 1);
+}
+
+Vec_unique Map::get_spatial_data_dmda_blocked() const
+{
+  return gather_dmda_blocked(0, m_ndim);
+}
+
+Vec_unique Map::gather_dmda_blocked(uinteger first, uinteger count) const
+{
+  initialize_dmda();
   AO ao_petsctonat; // N.B this is not going to be a leak, we are just borrowing a Petsc managed
                     // obj.
   PetscErrorCode perr =
       DMDAGetAO(*map_dmda, &ao_petsctonat); // Destroying this would break the dmda
   CHKERRABORT(m_comm, perr);
 
-  // Allocate temp vec
-  Vec_unique tmp_data = create_unique_vec();
-  DMCreateGlobalVector(*map_dmda, tmp_data.get());
+  // Temp vec gives the dmda layout
+  Vec_unique dmda_vec = create_unique_vec();
+  perr = DMCreateGlobalVector(*map_dmda, dmda_vec.get());
+  CHKERRABORT(m_comm, perr);
 
   // Get extents of local data in grad array
   integer startelem, datasize;
-  perr = VecGetOwnershipRange(*tmp_data, &startelem, &datasize);
+  perr = VecGetOwnershipRange(*dmda_vec, &startelem, &datasize);
   CHKERRABORT(m_comm, perr);
   datasize -= startelem;
-
-  // Target range is then just owned part of new data vec in appropriate ordering
-  IS_unique tgt_is(create_unique_is());
-  perr = ISCreateStride(m_comm, datasize, startelem, 1, tgt_is.get());
+  int nranks;
+  MPI_Comm_size(m_comm, &nranks);
+  const integer* dmda_ranges;
+  perr = VecGetOwnershipRanges(*dmda_vec, &dmda_ranges);
   CHKERRABORT(m_comm, perr);
-  perr = AOPetscToApplicationIS(ao_petsctonat, *tgt_is);
+
+  // Target range is the owned part of the dmda ordering, in natural indices
+  intvector dmda_idx(datasize, 0);
+  std::iota(dmda_idx.begin(), dmda_idx.end(), startelem);
+  perr = AOPetscToApplication(ao_petsctonat, datasize, dmda_idx.data());
   CHKERRABORT(m_comm, perr);
 
-  // Source range is equivalent range offset to dimension 
+  // Each rank receives its dmda block of every requested component in turn, so all components
+  // move in a single scatter. Source is the same nodes in each component.
+  intvector src_idx, tgt_idx;
+  src_idx.reserve(count * datasize);
+  tgt_idx.reserve(count * datasize);
+  for (uinteger comp = 0; comp < count; comp++)
+  {
+    for (integer idx = 0; idx < datasize; idx++)
+    {
+      src_idx.push_back(stacked_index(startelem + idx, first + comp));
+      tgt_idx.push_back(tiled_index(dmda_idx[idx], comp, count, dmda_ranges, nranks));
+    }
+  }
   IS_unique src_is(create_unique_is());
-  perr = ISCreateStride(m_comm, datasize, startelem + (dim * this->size()), 1, src_is.get());
+  perr = ISCreateGeneral(
+      m_comm, src_idx.size(), src_idx.data(), PETSC_USE_POINTER, src_is.get());
+  CHKERRABORT(m_comm, perr);
+  IS_unique tgt_is(create_unique_is());
+  perr = ISCreateGeneral(
+      m_comm, tgt_idx.size(), tgt_idx.data(), PETSC_USE_POINTER, tgt_is.get());
   CHKERRABORT(m_comm, perr);
 
+  Vec_unique tmp_data = create_tiled_vec(m_comm, *dmda_vec, count);
+
   // Now create the scatter
   VecScatter_unique sct = create_unique_vecscatter();
   perr = VecScatterCreate(*m_displacements, *src_is, *tmp_data, *tgt_is, sct.get());
@@ -245,6 +356,7 @@ Vec_unique Map::get_dim_data_dmda_blocked(uinteger dim) const
 
 void Map::calculate_basis()
 {
+  profiling::ScopedPhase phase("basis");
   // Get the full Nd basis
   floatvector scalings(m_ndim, 0.0);
   floatvector offsets(m_ndim, 0.0);
@@ -255,8 +367,20 @@ void Map::calculate_basis()
   n_ary_transform(
       [](floating x, floating a) -> floating { return -x / a; }, offsets.begin(),
       this->m_v_offsets.begin(), this->m_v_offsets.end(), this->m_v_node_spacing.begin());
-  m_basis = build_basis_matrix(
-      m_comm, map_shape, m_v_image_shape, scalings, offsets, m_ndim, m_ndim + 1);
+  m_basis = build_image_basis_matrix(
+      m_comm, *m_mask.dmda(), map_shape, scalings, offsets, m_ndim, m_basis_type);
+  if (m_basis_type == BasisType::cubic)
+  {
+    profiling::add_count("cubic_basis_builds");
+  }
+  m_tiled_basis = create_tiled_operator(m_comm, *m_basis, m_ndim + 1);
+
+  const integer* ranges;
+  int nranks;
+  MPI_Comm_size(m_comm, &nranks);
+  PetscErrorCode perr = MatGetOwnershipRangesColumn(*m_basis, &ranges);
+  CHKERRABORT(m_comm, perr);
+  m_node_ranges.assign(ranges, ranges + nranks + 1);
 
   // Now grab a 1d basis as a submatrix. Note can't do this the other way round because Petsc won't
   // allow reuse of rows/cols in MatCreateSubMatrix
@@ -280,24 +404,28 @@ void Map::calculate_basis()
 
 void Map::calculate_laplacian()
 {
+  profiling::ScopedPhase phase("laplacian");
   integer startrow, endrow;
-  PetscErrorCode perr = VecGetOwnershipRange(*m_displacements, &startrow, &endrow);
-  CHKERRABORT(m_comm, perr);
+  std::tie(startrow, endrow) = get_node_ownershiprange();
 
-  Mat_unique lapl = build_laplacian_matrix(m_comm, map_shape, startrow, endrow, m_ndim + 1);
-  perr = MatTransposeMatMult(*lapl, *lapl, MAT_INITIAL_MATRIX, PETSC_DEFAULT, m_lapl.get());
+  // keep L as well as L^T L, the least squares solver works with the unsquared operator
+  m_lapl_root = build_laplacian_matrix(m_comm, map_shape, startrow, endrow, 1);
+  PetscErrorCode perr = MatTransposeMatMult(
+      *m_lapl_root, *m_lapl_root, MAT_INITIAL_MATRIX, PETSC_DEFAULT, m_lapl.get());
   debug_creation(*m_lapl, "Mat_l_squared");
   CHKERRABORT(m_comm, perr);
 }
 
-std::pair<integer, integer> Map::get_displacement_ownershiprange() const
+std::pair<integer, integer> Map::get_node_ownershiprange() const
 {
-  std::pair<integer, integer> range;
-
-  PetscErrorCode perr = VecGetOwnershipRange(*m_displacements, &range.first, &range.second);
-  CHKERRABORT(m_comm, perr);
+  int rank;
+  MPI_Comm_rank(m_comm, &rank);
+  return std::make_pair(m_node_ranges[rank], m_node_ranges[rank + 1]);
+}
 
-  return range;
+integer Map::stacked_index(integer node, uinteger component) const
+{
+  return tiled_index(node, component, m_ndim + 1, m_node_ranges.data(), m_node_ranges.size() - 1);
 }
 
 const floating* Map::get_raw_data_ro() const
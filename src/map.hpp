@@ -22,22 +22,34 @@
 #include <utility>
 
 #include "types.hpp"
+#include "basis.hpp"
 
 class Map {
 public:
-  Map(const Image& mask, const floatvector& node_spacing);
+  Map(const Image& mask, const floatvector& node_spacing,
+      BasisType basis_type = BasisType::linear);
   Map(const Map& map, const floatvector& node_spacing);
 
   //  ~Map();
 
+  // The basis and Laplacian act on a single displacement component, see tiled_index for how the
+  // components are stored
   Mat* basis() const
   {
     return m_basis.get();
   }
+  Mat* tiled_basis() const
+  {
+    return m_tiled_basis.get();
+  }
   Mat* laplacian() const
   {
     return m_lapl.get();
   }
+  Mat* laplacian_root() const
+  {
+    return m_lapl_root.get();
+  }
   const floatvector2d node_locs() const
   {
     return m_vv_node_locs;
@@ -62,24 +74,32 @@ public:
   {
     return m_v_node_spacing;
   }
+  BasisType basis_type() const
+  {
+    return m_basis_type;
+  }
   integer size() const
   {
     return std::accumulate(map_shape.cbegin(), map_shape.cend(), 1, std::multiplies<>());
   }
 
   floatvector low_corner() const;
-  std::pair<integer, integer> get_displacement_ownershiprange() const;
+  std::pair<integer, integer> get_node_ownershiprange() const;
+  integer stacked_index(integer node, uinteger component) const;
 
   const floating* get_raw_data_ro() const;
   void release_raw_data_ro(const floating*& ptr) const;
 
   void update(const Vec& delta_vec);
+  void compose(const Vec& delta_vec);
   std::unique_ptr<Map> interpolate(const floatvector& new_spacing);
 
   std::unique_ptr<Image> warp(const Image& image, WorkSpace& wksp);
 
   std::pair<intvector, intvector> get_dmda_local_extents() const;
   Vec_unique get_dim_data_dmda_blocked(uinteger dim) const;
+  // Every spatial component, each rank's dmda block of component 0, 1, ... in turn
+  Vec_unique get_spatial_data_dmda_blocked() const;
 
   static intvector
   calculate_map_shape(intvector const& image_shape, floatvector const& nodespacing);
@@ -90,17 +110,22 @@ public:
   const Image& m_mask;
   uinteger m_ndim;
   floatvector m_v_node_spacing;
+  BasisType m_basis_type;
   floatvector m_v_offsets;
   intvector m_v_image_shape;
   intvector map_shape;
   floatvector2d m_vv_node_locs;
   Mat_unique m_basis;
+  Mat_unique m_tiled_basis;
   Mat_unique m_lapl;
+  Mat_unique m_lapl_root;
   Vec_unique m_displacements;
+  intvector m_node_ranges;
   mutable DM_unique map_dmda;
 
   void alloc_displacements();
   void initialize_dmda() const;
+  Vec_unique gather_dmda_blocked(uinteger first, uinteger count) const;
   void calculate_node_locs();
   void calculate_basis();
   void calculate_laplacian();
@@ -15,6 +15,75 @@
 
 #include "petsc_helpers.hpp"
 
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+// Rank-local rows of an MPIAIJ matrix as its diagonal and off-diagonal SeqAIJ parts
+std::pair<Mat, Mat> local_parts(MPI_Comm comm, const Mat &mat)
+{
+  Mat diag, offdiag;
+  PetscErrorCode perr = MatMPIAIJGetSeqAIJ(mat, &diag, &offdiag, nullptr);
+  CHKERRABORT(comm, perr);
+  return std::make_pair(diag, offdiag);
+}
+
+integer local_nonzeros(MPI_Comm comm, const Mat &part)
+{
+  MatInfo info;
+  PetscErrorCode perr = MatGetInfo(part, MAT_LOCAL, &info);
+  CHKERRABORT(comm, perr);
+  return static_cast<integer>(info.nz_used);
+}
+// Set, or add alpha times, the sources' value arrays in turn to those of the stacked matrix
+void update_stacked_values(
+    MPI_Comm comm, const std::vector<Mat> &sources, const Mat &stacked, floating alpha, bool add)
+{
+  std::pair<Mat, Mat> dest = local_parts(comm, stacked);
+  std::vector<Mat> dest_parts = {dest.first, dest.second};
+  for (size_t part = 0; part < dest_parts.size(); part++)
+  {
+    floating *destptr;
+    PetscErrorCode perr = MatSeqAIJGetArray(dest_parts[part], &destptr);
+    CHKERRABORT(comm, perr);
+    integer offset = 0;
+    for (const Mat &source : sources)
+    {
+      std::pair<Mat, Mat> parts = local_parts(comm, source);
+      const Mat &srcpart = (part == 0) ? parts.first : parts.second;
+      integer nnz = local_nonzeros(comm, srcpart);
+      const floating *srcptr;
+      perr = MatSeqAIJGetArrayRead(srcpart, &srcptr);
+      CHKERRABORT(comm, perr);
+      if (add)
+      {
+        std::transform(srcptr, srcptr + nnz, destptr + offset, destptr + offset,
+            [=](floating src, floating dst) -> floating { return dst + alpha * src; });
+      }
+      else
+      {
+        std::copy(srcptr, srcptr + nnz, destptr + offset);
+      }
+      perr = MatSeqAIJRestoreArrayRead(srcpart, &srcptr);
+      CHKERRABORT(comm, perr);
+      offset += nnz;
+    }
+    if (offset != local_nonzeros(comm, dest_parts[part]))
+    {
+      throw std::runtime_error("source patterns do not match the stacked matrix");
+    }
+    perr = MatSeqAIJRestoreArray(dest_parts[part], &destptr);
+    CHKERRABORT(comm, perr);
+  }
+  // the parts' states have moved on, the parent must as well for cached products to notice
+  PetscErrorCode perr = PetscObjectStateIncrease(reinterpret_cast<PetscObject>(stacked));
+  CHKERRABORT(comm, perr);
+}
+} // anonymous namespace
+
 bool vecs_equivalent(const Vec &vec1, const Vec &vec2)
 {
   // Ensure two vectors have the same local size, global size. and comm.
@@ -50,3 +119,111 @@ bool vecs_equivalent(const Vec &vec1, const Vec &vec2)
 
   return true;
 }
+
+integer tiled_index(integer idx, integer tile, integer ntiles, const integer *ranges, int nranks)
+{
+  // ranges is ascending with nranks + 1 entries, find the rank owning idx
+  const integer *owner = std::upper_bound(ranges, ranges + nranks + 1, idx) - 1;
+  integer localsize = *(owner + 1) - *owner;
+  return ntiles * *owner + tile * localsize + idx - *owner;
+}
+
+Vec_unique create_tiled_vec(MPI_Comm comm, const Vec &like, integer ntiles)
+{
+  integer localsize;
+  PetscErrorCode perr = VecGetLocalSize(like, &localsize);
+  CHKERRABORT(comm, perr);
+  Vec_unique tiled = create_unique_vec();
+  perr = VecCreateMPI(comm, ntiles * localsize, PETSC_DETERMINE, tiled.get());
+  CHKERRABORT(comm, perr);
+  return tiled;
+}
+
+Mat_unique create_tiled_operator(MPI_Comm comm, const Mat &scalar, integer ntiles)
+{
+  // MatNest's default index sets give exactly the per-rank stacked layout
+  std::vector<Mat> blocks(ntiles * ntiles, nullptr);
+  for (integer tile = 0; tile < ntiles; tile++)
+  {
+    blocks[tile * ntiles + tile] = scalar;
+  }
+  Mat_unique tiled = create_unique_mat();
+  PetscErrorCode perr =
+      MatCreateNest(comm, ntiles, nullptr, ntiles, nullptr, blocks.data(), tiled.get());
+  CHKERRABORT(comm, perr);
+  return tiled;
+}
+
+void stack_matrices(MPI_Comm comm, const std::vector<Mat> &blocks, const intvector &coltiles,
+    integer ncoltiles, Mat_unique &stacked)
+{
+  int nranks;
+  MPI_Comm_size(comm, &nranks);
+  integer localcols;
+  PetscErrorCode perr = MatGetLocalSize(blocks.front(), nullptr, &localcols);
+  CHKERRABORT(comm, perr);
+  const integer *colranges;
+  perr = MatGetOwnershipRangesColumn(blocks.front(), &colranges);
+  CHKERRABORT(comm, perr);
+
+  // Columns keep their order under tiled_index so rows stay sorted, and a column is rank-local
+  // in the stacked layout exactly when it is in the block's, which is what lets
+  // copy_stacked_values work on the value arrays alone
+  integer localrows = 0;
+  intvector idxn(1, 0), idxm, tilecols;
+  floatvector mdat;
+  for (size_t block = 0; block < blocks.size(); block++)
+  {
+    integer rowstart, rowend;
+    perr = MatGetOwnershipRange(blocks[block], &rowstart, &rowend);
+    CHKERRABORT(comm, perr);
+    localrows += rowend - rowstart;
+    integer tile = coltiles[block];
+    for (integer row = rowstart; row < rowend; row++)
+    {
+      integer ncols;
+      const integer *cols;
+      const floating *vals;
+      perr = MatGetRow(blocks[block], row, &ncols, &cols, &vals);
+      CHKERRABORT(comm, perr);
+      tilecols.resize(ncols);
+      std::transform(cols, cols + ncols, tilecols.begin(), [=](integer col) -> integer {
+        return tiled_index(col, tile, ncoltiles, colranges, nranks);
+      });
+      idxm.insert(idxm.end(), tilecols.cbegin(), tilecols.cend());
+      mdat.insert(mdat.end(), vals, vals + ncols);
+      idxn.push_back(idxm.size());
+      perr = MatRestoreRow(blocks[block], row, &ncols, &cols, &vals);
+      CHKERRABORT(comm, perr);
+    }
+  }
+
+  perr = MatCreateMPIAIJWithArrays(comm, localrows, ncoltiles * localcols, PETSC_DETERMINE,
+      PETSC_DETERMINE, idxn.data(), idxm.data(), mdat.data(), stacked.get());
+  CHKERRABORT(comm, perr);
+}
+
+void copy_stacked_values(MPI_Comm comm, const std::vector<Mat> &sources, const Mat &stacked)
+{
+  update_stacked_values(comm, sources, stacked, 1., false);
+}
+
+void add_stacked_values(
+    MPI_Comm comm, floating alpha, const std::vector<Mat> &sources, const Mat &stacked)
+{
+  update_stacked_values(comm, sources, stacked, alpha, true);
+}
+
+void tile_matrix(MPI_Comm comm, const Mat &scalar, integer ntiles, Mat_unique &tiled)
+{
+  if (*tiled == nullptr)
+  {
+    intvector coltiles(ntiles);
+    std::iota(coltiles.begin(), coltiles.end(), 0);
+    stack_matrices(comm, std::vector<Mat>(ntiles, scalar), coltiles, ntiles, tiled);
+  }
+  else
+  {
+    copy_stacked_values(comm, std::vector<Mat>(ntiles, scalar), *tiled);
+  }
+}
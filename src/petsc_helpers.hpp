@@ -16,10 +16,43 @@
 #ifndef PETSC_HELPERS_HPP
 #define PETSC_HELPERS_HPP
 
+#include <vector>
+
+#include <petscmat.h>
 #include <petscvec.h>
 
 #include "types.hpp"
 
 bool vecs_equivalent(const Vec &vec1, const Vec &vec2);
 
+// Stacked vectors hold ntiles components sharing one scalar layout. Each rank stores its part of
+// every component contiguously, so component tile of scalar index idx, owned by rank q, is at
+// ntiles * ranges[q] + tile * (ranges[q + 1] - ranges[q]) + idx - ranges[q].
+integer tiled_index(integer idx, integer tile, integer ntiles, const integer *ranges, int nranks);
+
+// Vector with the stacked layout of ntiles copies of like
+Vec_unique create_tiled_vec(MPI_Comm comm, const Vec &like, integer ntiles);
+
+// Block diagonal operator applying scalar to every component of a stacked vector. The blocks all
+// reference scalar rather than copying it.
+Mat_unique create_tiled_operator(MPI_Comm comm, const Mat &scalar, integer ntiles);
+
+// Explicit AIJ whose rank-local rows are the rank-local rows of each block in turn. The blocks
+// share one scalar column layout and block i's columns are placed in component coltiles[i] of an
+// ncoltiles stacked layout.
+void stack_matrices(MPI_Comm comm, const std::vector<Mat> &blocks, const intvector &coltiles,
+    integer ncoltiles, Mat_unique &stacked);
+
+// Refresh the values of a stacked matrix without touching its pattern. The sources' rank-local
+// rows in turn must have the stacked rows' patterns, e.g the blocks it was stacked from, so their
+// diagonal and off-diagonal value arrays are copied straight across.
+void copy_stacked_values(MPI_Comm comm, const std::vector<Mat> &sources, const Mat &stacked);
+// As copy_stacked_values but adds alpha times the sources' values
+void add_stacked_values(
+    MPI_Comm comm, floating alpha, const std::vector<Mat> &sources, const Mat &stacked);
+
+// Explicit AIJ copy of the tiled operator, for when the components need different values. If
+// tiled already holds a copy its values are refreshed in place with copy_stacked_values.
+void tile_matrix(MPI_Comm comm, const Mat &scalar, integer ntiles, Mat_unique &tiled);
+
 #endif
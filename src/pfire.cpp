@@ -16,6 +16,7 @@
 #include <chrono>
 
 #include "baseconfiguration.hpp"
+#include "decomposition.hpp"
 #include "iniconfiguration.hpp"
 #include "setup.hpp"
 #include "shirtemulation.hpp"
@@ -27,6 +28,7 @@
 #include "map.hpp"
 #include "types.hpp"
 #include "math_utils.hpp"
+#include "profiling.hpp"
 
 #include "xdmfwriter.hpp"
 
@@ -54,6 +56,7 @@ int main(int argc, char **argv)
   }
 
   configobj->validate_config();
+  apply_petsc_options(*configobj);
 
   auto tstart = std::chrono::high_resolution_clock::now();
   mainflow(configobj);
@@ -71,9 +74,13 @@ int main(int argc, char **argv)
 
 void mainflow(std::shared_ptr<ConfigurationBase> config)
 {
+  profiling::set_memory_tracking(config->grab<bool>("profile_memory"));
+  decomposition::configure(*config);
+
   std::unique_ptr<Image> fixed;
   try
   {
+    profiling::ScopedPhase phase("io");
     fixed = Image::load_file(config->grab<std::string>("fixed"));
   }
   catch (std::exception &e)
@@ -92,6 +99,7 @@ void mainflow(std::shared_ptr<ConfigurationBase> config)
   std::unique_ptr<Image> moved;
   try
   {
+    profiling::ScopedPhase phase("io");
     moved = Image::load_file(config->grab<std::string>("moved"), fixed.get());
   }
   catch (std::exception &e)
@@ -110,6 +118,7 @@ void mainflow(std::shared_ptr<ConfigurationBase> config)
   Elastic reg(*fixed, *moved, nodespacing, *config);
   reg.autoregister();
 
+  profiling::begin_phase("io");
   std::string outfile = config->grab<std::string>("registered");
   BaseWriter_unique wtr = BaseWriter::get_writer_for_filename(outfile, fixed->comm());
   wtr->write_image(*reg.registered());
@@ -117,4 +126,10 @@ void mainflow(std::shared_ptr<ConfigurationBase> config)
   outfile = config->grab<std::string>("map");
   wtr = BaseWriter::get_writer_for_filename(outfile, fixed->comm());
   wtr->write_map(*reg.m_p_map);
+  profiling::end_phase("io");
+
+  if (config->grab<bool>("profile") || config->grab<bool>("profile_memory"))
+  {
+    profiling::print_summary(fixed->comm());
+  }
 }
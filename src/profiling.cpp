@@ -0,0 +1,325 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "profiling.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <petsclog.h>
+
+namespace
+{
+using clock_type = std::chrono::steady_clock;
+
+struct PhaseState {
+  clock_type::time_point start;
+  bool running = false;
+  PetscLogEvent event = 0;
+};
+
+profiling::phase_map records;
+profiling::counter_map counts;
+profiling::memory_map phase_memory;
+profiling::generation_memory_map gen_memory;
+bool track_memory = false;
+integer current_generation = 0;
+std::map<std::string, PhaseState> states;
+PetscClassId pfire_classid = 0;
+
+PhaseState &get_state(const std::string &name)
+{
+  auto it = states.find(name);
+  if (it != states.end())
+  {
+    return it->second;
+  }
+  // First use of this phase, also register a matching PETSc event
+  if (pfire_classid == 0)
+  {
+    PetscErrorCode perr = PetscClassIdRegister("pFIRE", &pfire_classid);
+    CHKERRABORT(PETSC_COMM_WORLD, perr);
+  }
+  PhaseState &state = states[name];
+  PetscErrorCode perr = PetscLogEventRegister(name.c_str(), pfire_classid, &state.event);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+  return state;
+}
+
+void update_high_water(profiling::MemoryRecord &rec, const profiling::MemoryRecord &sample)
+{
+  rec.resident = std::max(rec.resident, sample.resident);
+  rec.petsc_malloc = std::max(rec.petsc_malloc, sample.petsc_malloc);
+}
+
+// Reduce a map of per-rank high-water marks, all ranks must hold the same keys
+template <typename keytype>
+std::map<keytype, profiling::MemoryStats>
+reduce_memory(const std::map<keytype, profiling::MemoryRecord> &local, MPI_Comm comm)
+{
+  std::vector<double> maxdata, sumdata;
+  for (const auto &it : local)
+  {
+    maxdata.push_back(it.second.resident);
+    maxdata.push_back(it.second.petsc_malloc);
+  }
+  sumdata = maxdata;
+  MPI_Allreduce(MPI_IN_PLACE, maxdata.data(), maxdata.size(), MPI_DOUBLE, MPI_MAX, comm);
+  MPI_Allreduce(MPI_IN_PLACE, sumdata.data(), sumdata.size(), MPI_DOUBLE, MPI_SUM, comm);
+  int nranks;
+  MPI_Comm_size(comm, &nranks);
+
+  std::map<keytype, profiling::MemoryStats> reduced;
+  auto max_it = maxdata.cbegin();
+  auto sum_it = sumdata.cbegin();
+  for (const auto &it : local)
+  {
+    profiling::MemoryStats &stats = reduced[it.first];
+    stats.max.resident = *max_it++;
+    stats.max.petsc_malloc = *max_it++;
+    stats.mean.resident = *sum_it++ / nranks;
+    stats.mean.petsc_malloc = *sum_it++ / nranks;
+  }
+  return reduced;
+}
+
+double imbalance(double max, double mean)
+{
+  return mean > 0 ? max / mean : 1.;
+}
+
+void print_memory_line(
+    std::ostream &out, const std::string &name, const profiling::MemoryStats &stats)
+{
+  constexpr double mib = 1024. * 1024.;
+  out << "  " << std::left << std::setw(20) << name << std::right << std::fixed
+      << std::setprecision(1) << std::setw(10) << stats.max.resident / mib << std::setw(10)
+      << stats.mean.resident / mib << std::setprecision(2) << std::setw(8)
+      << imbalance(stats.max.resident, stats.mean.resident) << std::setprecision(1)
+      << std::setw(10) << stats.max.petsc_malloc / mib << std::setw(10)
+      << stats.mean.petsc_malloc / mib << std::setprecision(2) << std::setw(8)
+      << imbalance(stats.max.petsc_malloc, stats.mean.petsc_malloc) << "\n";
+}
+} // anonymous namespace
+
+void profiling::begin_phase(const std::string &name)
+{
+  PhaseState &state = get_state(name);
+  if (state.running)
+  {
+    throw std::runtime_error("phase \"" + name + "\" is already running");
+  }
+  state.running = true;
+  if (track_memory)
+  {
+    sample_memory(name);
+  }
+  PetscErrorCode perr = PetscLogEventBegin(state.event, 0, 0, 0, 0);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+  state.start = clock_type::now();
+}
+
+void profiling::end_phase(const std::string &name)
+{
+  auto tend = clock_type::now();
+  PhaseState &state = get_state(name);
+  if (!state.running)
+  {
+    throw std::runtime_error("phase \"" + name + "\" was not started");
+  }
+  state.running = false;
+  PetscErrorCode perr = PetscLogEventEnd(state.event, 0, 0, 0, 0);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+
+  std::chrono::duration<double> diff = tend - state.start;
+  PhaseRecord &rec = records[name];
+  rec.calls++;
+  rec.seconds += diff.count();
+
+  if (track_memory)
+  {
+    sample_memory(name);
+  }
+}
+
+void profiling::add_count(const std::string &name, integer count)
+{
+  counts[name] += count;
+}
+
+const profiling::phase_map &profiling::phases()
+{
+  return records;
+}
+
+const profiling::counter_map &profiling::counters()
+{
+  return counts;
+}
+
+profiling::phase_map profiling::gather_max(MPI_Comm comm)
+{
+  // All ranks pass through the same (collective) phases so the sorted maps line up
+  std::vector<double> data;
+  for (const auto &it : records)
+  {
+    data.push_back(it.second.seconds);
+    data.push_back(static_cast<double>(it.second.calls));
+  }
+  MPI_Allreduce(MPI_IN_PLACE, data.data(), data.size(), MPI_DOUBLE, MPI_MAX, comm);
+
+  phase_map reduced;
+  auto data_it = data.cbegin();
+  for (const auto &it : records)
+  {
+    PhaseRecord &rec = reduced[it.first];
+    rec.seconds = *data_it++;
+    rec.calls = static_cast<integer>(*data_it++);
+  }
+  return reduced;
+}
+
+profiling::counter_map profiling::gather_counters(MPI_Comm comm)
+{
+  std::vector<double> data;
+  for (const auto &it : counts)
+  {
+    data.push_back(static_cast<double>(it.second));
+  }
+  MPI_Allreduce(MPI_IN_PLACE, data.data(), data.size(), MPI_DOUBLE, MPI_MAX, comm);
+
+  counter_map reduced;
+  auto data_it = data.cbegin();
+  for (const auto &it : counts)
+  {
+    reduced[it.first] = static_cast<integer>(*data_it++);
+  }
+  return reduced;
+}
+
+void profiling::set_memory_tracking(bool enabled)
+{
+  track_memory = enabled;
+}
+
+bool profiling::memory_tracking()
+{
+  return track_memory;
+}
+
+void profiling::set_generation(integer generation)
+{
+  current_generation = generation;
+}
+
+void profiling::sample_memory(const std::string &name)
+{
+  PetscLogDouble resident, petsc_malloc;
+  PetscErrorCode perr = PetscMemoryGetCurrentUsage(&resident);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+  perr = PetscMallocGetCurrentUsage(&petsc_malloc);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+
+  MemoryRecord sample;
+  sample.resident = resident;
+  sample.petsc_malloc = petsc_malloc;
+  update_high_water(phase_memory[name], sample);
+  update_high_water(gen_memory[current_generation], sample);
+}
+
+const profiling::memory_map &profiling::memory()
+{
+  return phase_memory;
+}
+
+const profiling::generation_memory_map &profiling::generation_memory()
+{
+  return gen_memory;
+}
+
+profiling::memory_stats_map profiling::gather_memory(MPI_Comm comm)
+{
+  return reduce_memory(phase_memory, comm);
+}
+
+profiling::generation_memory_stats_map profiling::gather_generation_memory(MPI_Comm comm)
+{
+  return reduce_memory(gen_memory, comm);
+}
+
+void profiling::print_summary(MPI_Comm comm)
+{
+  phase_map reduced = gather_max(comm);
+  counter_map reduced_counts = gather_counters(comm);
+
+  std::ostringstream summary;
+  summary << "Phase timings (slowest rank):\n";
+  for (const auto &it : reduced)
+  {
+    summary << "  " << std::left << std::setw(20) << it.first << std::right << std::setw(8)
+            << it.second.calls << " calls " << std::fixed << std::setprecision(3)
+            << std::setw(12) << it.second.seconds << " s\n";
+  }
+  for (const auto &it : reduced_counts)
+  {
+    summary << "  " << std::left << std::setw(20) << it.first << std::right << std::setw(8)
+            << it.second << "\n";
+  }
+  // pFIRE's own global reductions (PETSc's inside the solvers are in -log_view)
+  auto reductions = reduced_counts.find("global_reductions");
+  auto iterations = reduced_counts.find("iterations");
+  if (reductions != reduced_counts.end() && iterations != reduced_counts.end()
+      && iterations->second > 0)
+  {
+    summary << "  " << std::left << std::setw(20) << "reductions/iter" << std::right
+            << std::setw(8) << std::fixed << std::setprecision(2)
+            << static_cast<double>(reductions->second) / iterations->second << "\n";
+  }
+
+  if (track_memory)
+  {
+    memory_stats_map reduced_memory = gather_memory(comm);
+    generation_memory_stats_map reduced_generations = gather_generation_memory(comm);
+
+    summary << "Memory high-water (MiB):\n";
+    summary << "  " << std::left << std::setw(20) << "" << std::right << std::setw(10)
+            << "rss max" << std::setw(10) << "mean" << std::setw(8) << "imbal" << std::setw(10)
+            << "malloc max" << std::setw(10) << "mean" << std::setw(8) << "imbal" << "\n";
+    for (const auto &it : reduced_memory)
+    {
+      print_memory_line(summary, it.first, it.second);
+    }
+    for (const auto &it : reduced_generations)
+    {
+      // Generation 0 is everything before the first generation starts e.g loading, setup
+      std::string label = it.first == 0 ? "setup" : "generation " + std::to_string(it.first);
+      print_memory_line(summary, label, it.second);
+    }
+  }
+  PetscPrintf(comm, summary.str().c_str());
+}
+
+void profiling::reset()
+{
+  records.clear();
+  counts.clear();
+  phase_memory.clear();
+  gen_memory.clear();
+  current_generation = 0;
+}
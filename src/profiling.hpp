@@ -0,0 +1,104 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#ifndef PROFILING_HPP
+#define PROFILING_HPP
+
+#include <map>
+#include <string>
+
+#include <mpi.h>
+
+#include "types.hpp"
+
+namespace profiling
+{
+struct PhaseRecord {
+  integer calls = 0;
+  double seconds = 0.;
+};
+
+// Memory high-water marks in bytes. resident is the process RSS from PetscMemoryGetCurrentUsage,
+// petsc_malloc is PetscMallocGetCurrentUsage which is only tracked when PETSc's logging malloc is
+// active (debug builds or -malloc_debug), otherwise zero.
+struct MemoryRecord {
+  double resident = 0.;
+  double petsc_malloc = 0.;
+};
+
+// Across ranks, imbalance is max / mean
+struct MemoryStats {
+  MemoryRecord max;
+  MemoryRecord mean;
+};
+
+using phase_map = std::map<std::string, PhaseRecord>;
+using counter_map = std::map<std::string, integer>;
+using memory_map = std::map<std::string, MemoryRecord>;
+using generation_memory_map = std::map<integer, MemoryRecord>;
+using memory_stats_map = std::map<std::string, MemoryStats>;
+using generation_memory_stats_map = std::map<integer, MemoryStats>;
+
+void begin_phase(const std::string &name);
+void end_phase(const std::string &name);
+
+// Event counters e.g iterations, Krylov iterations
+void add_count(const std::string &name, integer count = 1);
+
+// Rank-local records, phases are keyed (and therefore sorted) by name
+const phase_map &phases();
+const counter_map &counters();
+// Collective: slowest rank's time and call count for each phase, largest count for each counter
+phase_map gather_max(MPI_Comm comm);
+counter_map gather_counters(MPI_Comm comm);
+
+// Memory sampling at every phase boundary, off by default. Samples update the high-water mark of
+// the phase and of the current generation.
+void set_memory_tracking(bool enabled);
+bool memory_tracking();
+void set_generation(integer generation);
+void sample_memory(const std::string &name);
+
+const memory_map &memory();
+const generation_memory_map &generation_memory();
+// Collective: max and mean over ranks of each rank's high-water marks
+memory_stats_map gather_memory(MPI_Comm comm);
+generation_memory_stats_map gather_generation_memory(MPI_Comm comm);
+
+void print_summary(MPI_Comm comm);
+void reset();
+
+// Time a scope as a named phase, also logged as a PETSc event so shows in -log_view
+class ScopedPhase {
+public:
+  explicit ScopedPhase(const std::string &name) : m_name(name)
+  {
+    begin_phase(m_name);
+  }
+  ~ScopedPhase()
+  {
+    end_phase(m_name);
+  }
+
+  ScopedPhase(const ScopedPhase &) = delete;
+  ScopedPhase &operator=(const ScopedPhase &) = delete;
+
+private:
+  std::string m_name;
+};
+
+} // namespace profiling
+
+#endif // PROFILING_HPP
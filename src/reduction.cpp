@@ -0,0 +1,105 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "reduction.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <petscsys.h>
+
+#include "profiling.hpp"
+
+namespace
+{
+MPI_Datatype tagged_type = MPI_DATATYPE_NULL;
+MPI_Op tagged_op = MPI_OP_NULL;
+
+// Every element is a (value, is_max) pair, so any whole number of them can be combined
+void tagged_sum_max(void* in, void* inout, int* len, MPI_Datatype* /*type*/)
+{
+  const double* src = static_cast<const double*>(in);
+  double* tgt = static_cast<double*>(inout);
+  for (int idx = 0; idx < 2 * *len; idx += 2)
+  {
+    tgt[idx] = tgt[idx + 1] != 0 ? std::max(tgt[idx], src[idx]) : tgt[idx] + src[idx];
+  }
+}
+
+PetscErrorCode free_tagged_reduction()
+{
+  MPI_Op_free(&tagged_op);
+  MPI_Type_free(&tagged_type);
+  return 0;
+}
+
+// Created on first use and released by PetscFinalize
+void create_tagged_reduction()
+{
+  if (tagged_op != MPI_OP_NULL)
+  {
+    return;
+  }
+  MPI_Type_contiguous(2, MPI_DOUBLE, &tagged_type);
+  MPI_Type_commit(&tagged_type);
+  MPI_Op_create(&tagged_sum_max, 1, &tagged_op);
+  PetscErrorCode perr = PetscRegisterFinalize(&free_tagged_reduction);
+  CHKERRABORT(PETSC_COMM_WORLD, perr);
+}
+} // anonymous namespace
+
+FusedReduction::FusedReduction(MPI_Comm comm)
+    : m_comm(comm), m_buffer(std::vector<double>()), m_reduced(false)
+{
+}
+
+size_t FusedReduction::add_sum(double local)
+{
+  return add(local, 0.);
+}
+
+size_t FusedReduction::add_max(double local)
+{
+  return add(local, 1.);
+}
+
+size_t FusedReduction::add(double local, double is_max)
+{
+  if (m_reduced)
+  {
+    throw std::runtime_error("FusedReduction values must be added before reduce");
+  }
+  m_buffer.push_back(local);
+  m_buffer.push_back(is_max);
+  return m_buffer.size() / 2 - 1;
+}
+
+void FusedReduction::reduce()
+{
+  create_tagged_reduction();
+  MPI_Allreduce(MPI_IN_PLACE, m_buffer.data(), static_cast<int>(m_buffer.size() / 2),
+      tagged_type, tagged_op, m_comm);
+  m_reduced = true;
+  profiling::add_count("global_reductions");
+}
+
+double FusedReduction::result(size_t idx) const
+{
+  if (!m_reduced)
+  {
+    throw std::runtime_error("FusedReduction results read before reduce");
+  }
+  return m_buffer.at(2 * idx);
+}
@@ -0,0 +1,50 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#ifndef REDUCTION_HPP
+#define REDUCTION_HPP
+
+#include <vector>
+
+#include <mpi.h>
+
+#include "types.hpp"
+
+// Several scalar sum and max reductions packed into a single allreduce, so values needed at the
+// same point cost one global synchronization rather than one each. Add the rank-local values,
+// reduce, then read the results. Values are carried in double whatever the precision of
+// floating, so sums that later cancel keep their digits.
+class FusedReduction {
+public:
+  explicit FusedReduction(MPI_Comm comm);
+
+  // Return the index of the value for result()
+  size_t add_sum(double local);
+  size_t add_max(double local);
+
+  void reduce();
+  double result(size_t idx) const;
+
+private:
+  size_t add(double local, double is_max);
+
+  MPI_Comm m_comm;
+  // Each value is paired with a flag selecting max over sum, so the operator needs no other
+  // knowledge of the packing
+  std::vector<double> m_buffer;
+  bool m_reduced;
+};
+
+#endif // REDUCTION_HPP
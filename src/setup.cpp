@@ -84,6 +84,26 @@ void pfire_setup(const std::vector<std::string>& petsc_args)
   register_plugins();
 }
 
+void apply_petsc_options(const ConfigurationBase &config)
+{
+  // Insert options from the configuration file into the PETSc database. Generation specific
+  // options keep their genN_ prefix and are brought into effect by Elastic. Options already
+  // given on the command line, in PETSC_OPTIONS or in an options file take precedence.
+  for (const auto &opt : config.petsc_options())
+  {
+    PetscBool set;
+    PetscErrorCode perr = PetscOptionsHasName(nullptr, nullptr, opt.first.c_str(), &set);
+    CHKERRABORT(PETSC_COMM_WORLD, perr);
+    if (set)
+    {
+      continue;
+    }
+    const char *value = opt.second.empty() ? nullptr : opt.second.c_str();
+    perr = PetscOptionsSetValue(nullptr, opt.first.c_str(), value);
+    CHKERRABORT(PETSC_COMM_WORLD, perr);
+  }
+}
+
 void check_and_warn_odd_comm()
 {
   // Check for even number of processors, warn on oddness
@@ -97,7 +117,7 @@ void check_and_warn_odd_comm()
               << "This makes efficient subdivision of the problem much harder and will likely "
               << "lead to reduced performance.\n"
               << "Extreme cases may make viable partitioning impossible and cause job failure. "
-              << "You have been warned!\n\n"
+              << "You have been warned! Setting \"decomposition = balanced\" may help.\n\n"
               << std::flush;
   }
 }
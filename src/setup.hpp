@@ -19,10 +19,14 @@
 #include <string>
 #include <vector>
 
+#include "baseconfiguration.hpp"
+
 std::string get_invocation_name(const std::string &argzero);
 
 void pfire_setup(const std::vector<std::string> &petsc_args);
 
+void apply_petsc_options(const ConfigurationBase &config);
+
 void check_and_warn_odd_comm();
 void print_welcome_message();
 
@@ -0,0 +1,240 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#include "synthetic.hpp"
+
+#include <cmath>
+#include <tuple>
+
+#include <petscdmda.h>
+
+#include "image.hpp"
+#include "indexing.hpp"
+#include "map.hpp"
+#include "workspace.hpp"
+
+namespace
+{
+// Field component dim at a map node, zero for the luminance component
+floating field_at_node(
+    const Map &map, const floatvector2d &node_locs, const displacement_field &field,
+    integer node, uinteger dim)
+{
+  if (dim >= map.ndim())
+  {
+    return 0.;
+  }
+  intvector map_shape(map.shape().cbegin(), map.shape().cbegin() + map.ndim());
+  intvector coord = unravel(node, map_shape);
+  floatvector loc(map.ndim(), 0.);
+  for (uinteger idim = 0; idim < map.ndim(); idim++)
+  {
+    loc[idim] = node_locs[idim][coord[idim]];
+  }
+  return field(loc)[dim];
+}
+} // anonymous namespace
+
+std::unique_ptr<Image>
+synthetic_image(const intvector &shape, const displacement_field &field, MPI_Comm comm)
+{
+  std::unique_ptr<Image> image = std::make_unique<Image>(shape, comm);
+
+  integer i_lo, i_hi, j_lo, j_hi, k_lo, k_hi;
+  PetscErrorCode perr =
+      DMDAGetCorners(*image->dmda(), &i_lo, &j_lo, &k_lo, &i_hi, &j_hi, &k_hi);
+  CHKERRABORT(comm, perr);
+  i_hi += i_lo;
+  j_hi += j_lo;
+  k_hi += k_lo;
+
+  floating ***ptr;
+  perr = DMDAVecGetArray(*image->dmda(), *image->global_vec(), &ptr);
+  CHKERRABORT(comm, perr);
+  floatvector loc(image->ndim(), 0.);
+  for (integer k = k_lo; k < k_hi; k++)
+  {
+    for (integer j = j_lo; j < j_hi; j++)
+    {
+      for (integer i = i_lo; i < i_hi; i++)
+      {
+        loc[0] = i;
+        loc[1] = j;
+        if (image->ndim() == 3)
+        {
+          loc[2] = k;
+        }
+        floatvector src = loc;
+        if (field)
+        {
+          floatvector disp = field(loc);
+          std::transform(src.begin(), src.end(), disp.begin(), src.begin(), std::plus<>());
+        }
+        ptr[k][j][i] = synthetic_pattern(src, image->shape());
+      }
+    }
+  }
+  perr = DMDAVecRestoreArray(*image->dmda(), *image->global_vec(), &ptr);
+  CHKERRABORT(comm, perr);
+
+  return image;
+}
+
+floating synthetic_pattern(const floatvector &loc, const intvector &shape)
+{
+  // Smooth, strictly positive pattern with features at a few scales so that every part of the
+  // image has gradients for the registration to work with
+  floating value = 1.0;
+  for (size_t idim = 0; idim < loc.size(); idim++)
+  {
+    floating x = loc[idim] / shape[idim];
+    value += 0.25 * std::sin(2 * M_PI * 3 * x) + 0.125 * std::cos(2 * M_PI * 7 * x + idim);
+  }
+  return value;
+}
+
+displacement_field translation_field(const floatvector &shift)
+{
+  return [shift](const floatvector &loc) -> floatvector {
+    floatvector disp(loc.size(), 0.);
+    std::copy_n(shift.cbegin(), std::min(shift.size(), loc.size()), disp.begin());
+    return disp;
+  };
+}
+
+displacement_field sinusoidal_field(const intvector &shape, floating amplitude)
+{
+  // One full period across the image in each dimension, displacement along each axis depends on
+  // position along the next so the field has shear as well as compression
+  return [shape, amplitude](const floatvector &loc) -> floatvector {
+    floatvector disp(loc.size(), 0.);
+    for (size_t idim = 0; idim < loc.size(); idim++)
+    {
+      size_t odim = (idim + 1) % loc.size();
+      disp[idim] = amplitude * std::sin(2 * M_PI * loc[odim] / shape[odim]);
+    }
+    return disp;
+  };
+}
+
+displacement_field bump_field(const floatvector &centre, floating amplitude, floating width)
+{
+  // Radial gaussian bump, displaces away from centre
+  return [centre, amplitude, width](const floatvector &loc) -> floatvector {
+    floatvector disp(loc.size(), 0.);
+    floating r2 = 0.;
+    for (size_t idim = 0; idim < loc.size(); idim++)
+    {
+      disp[idim] = loc[idim] - centre[idim];
+      r2 += disp[idim] * disp[idim];
+    }
+    floating scale = amplitude * std::exp(-r2 / (2 * width * width)) / width;
+    std::transform(disp.begin(), disp.end(), disp.begin(),
+        [scale](floating x) -> floating { return x * scale; });
+    return disp;
+  };
+}
+
+void set_map_displacements(Map &map, const displacement_field &field)
+{
+  integer lo, hi;
+  std::tie(lo, hi) = map.get_node_ownershiprange();
+  const floatvector2d node_locs = map.node_locs();
+
+  // local data holds each component of the owned nodes in turn
+  floating *ptr;
+  PetscErrorCode perr = VecGetArray(*map.m_displacements, &ptr);
+  CHKERRABORT(map.comm(), perr);
+  for (uinteger dim = 0; dim <= map.ndim(); dim++)
+  {
+    for (integer node = lo; node < hi; node++)
+    {
+      ptr[dim * (hi - lo) + node - lo] = field_at_node(map, node_locs, field, node, dim);
+    }
+  }
+  perr = VecRestoreArray(*map.m_displacements, &ptr);
+  CHKERRABORT(map.comm(), perr);
+}
+
+floating map_rms_error(const Map &map, const displacement_field &field)
+{
+  integer lo, hi;
+  std::tie(lo, hi) = map.get_node_ownershiprange();
+  const floatvector2d node_locs = map.node_locs();
+  integer spatial_size = map.size() * map.ndim();
+
+  floating sumsq = 0.;
+  const floating *ptr = map.get_raw_data_ro();
+  for (uinteger dim = 0; dim < map.ndim(); dim++)
+  {
+    for (integer node = lo; node < hi; node++)
+    {
+      floating expected = field_at_node(map, node_locs, field, node, dim);
+      floating diff = ptr[dim * (hi - lo) + node - lo] - expected;
+      sumsq += diff * diff;
+    }
+  }
+  map.release_raw_data_ro(ptr);
+
+  MPI_Allreduce(MPI_IN_PLACE, &sumsq, 1, MPIU_SCALAR, MPI_SUM, map.comm());
+  return std::sqrt(sumsq / spatial_size);
+}
+
+floating pixel_rms_error(const Map &map, const Image &image, const displacement_field &field)
+{
+  // interpolate the map to the pixels the same way Map::warp does
+  WorkSpace wksp(image, map);
+  PetscErrorCode perr = MatMult(*map.tiled_basis(), *map.m_displacements, *wksp.m_stacktmp);
+  CHKERRABORT(map.comm(), perr);
+  wksp.scatter_stacked_to_grads();
+
+  integer i_lo, i_hi, j_lo, j_hi, k_lo, k_hi;
+  perr = DMDAGetCorners(*image.dmda(), &i_lo, &j_lo, &k_lo, &i_hi, &j_hi, &k_hi);
+  CHKERRABORT(map.comm(), perr);
+  i_hi += i_lo;
+  j_hi += j_lo;
+  k_hi += k_lo;
+
+  floating sumsq = 0.;
+  for (uinteger dim = 0; dim < map.ndim(); dim++)
+  {
+    const floating ***ptr;
+    perr = DMDAVecGetArrayRead(*image.dmda(), *wksp.m_globaltmps[dim], &ptr);
+    CHKERRABORT(map.comm(), perr);
+    floatvector loc(map.ndim(), 0.);
+    for (integer k = k_lo; k < k_hi; k++)
+    {
+      for (integer j = j_lo; j < j_hi; j++)
+      {
+        for (integer i = i_lo; i < i_hi; i++)
+        {
+          loc[0] = i;
+          loc[1] = j;
+          if (map.ndim() == 3)
+          {
+            loc[2] = k;
+          }
+          floating diff = ptr[k][j][i] - field(loc)[dim];
+          sumsq += diff * diff;
+        }
+      }
+    }
+    perr = DMDAVecRestoreArrayRead(*image.dmda(), *wksp.m_globaltmps[dim], &ptr);
+    CHKERRABORT(map.comm(), perr);
+  }
+
+  MPI_Allreduce(MPI_IN_PLACE, &sumsq, 1, MPIU_SCALAR, MPI_SUM, map.comm());
+  return std::sqrt(sumsq / (image.size() * map.ndim()));
+}
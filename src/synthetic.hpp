@@ -0,0 +1,57 @@
+//
+//   Copyright 2019 University of Sheffield
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+
+#ifndef SYNTHETIC_HPP
+#define SYNTHETIC_HPP
+
+#include <functional>
+#include <memory>
+
+#include <mpi.h>
+
+#include "types.hpp"
+
+// Synthetic test images with analytically known deformations.
+//
+// A displacement field maps a pixel location to its displacement (same length as location). The
+// image generated with field u is the reference pattern sampled at x + u(x), i.e the result of
+// warping the undeformed pattern with map u, so registering the undeformed image onto it should
+// recover u.
+using displacement_field = std::function<floatvector(const floatvector &loc)>;
+
+std::unique_ptr<Image> synthetic_image(
+    const intvector &shape, const displacement_field &field = nullptr,
+    MPI_Comm comm = PETSC_COMM_WORLD);
+
+floating synthetic_pattern(const floatvector &loc, const intvector &shape);
+
+displacement_field translation_field(const floatvector &shift);
+displacement_field sinusoidal_field(const intvector &shape, floating amplitude);
+displacement_field bump_field(const floatvector &centre, floating amplitude, floating width);
+
+// Set the map displacements to the field sampled at the map nodes, luminance is zeroed. Warping
+// an image with this map applies the field through the same path the registration uses.
+void set_map_displacements(Map &map, const displacement_field &field);
+
+// RMS difference between the map displacements and the field sampled at the map nodes, over all
+// spatial components and all ranks
+floating map_rms_error(const Map &map, const displacement_field &field);
+
+// RMS difference between the displacement the map interpolates at the pixels of image and the
+// field at those pixels. Unlike map_rms_error this compares what the warp actually applies, so
+// it is meaningful for bases whose node values are coefficients rather than samples.
+floating pixel_rms_error(const Map &map, const Image &image, const displacement_field &field);
+
+#endif // SYNTHETIC_HPP
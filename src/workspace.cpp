@@ -15,12 +15,29 @@
 
 #include "workspace.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <petscdmda.h>
+
+#include "basis.hpp"
+#include "petsc_helpers.hpp"
+#include "profiling.hpp"
+#include "reduction.hpp"
+
 WorkSpace::WorkSpace(const Image& image, const Map& map)
     : m_comm(image.comm()), m_dmda(image.dmda()), m_size(image.size()),
-      m_globaltmps(std::vector<Vec_unique>()), m_iss(std::vector<IS_unique>()),
-      m_scatterers(std::vector<VecScatter_unique>()), m_stacktmp(create_unique_vec()),
+      m_globaltmps(std::vector<Vec_unique>()), m_stacktmp(create_unique_vec()),
       m_localtmp(create_unique_vec()), m_delta(create_unique_vec()), m_rhs(create_unique_vec()),
-      m_tmat(create_unique_mat()), ephemeral_count(0)
+      m_tmat(create_unique_mat()), m_normprod(create_unique_mat()), m_ksp(create_unique_ksp()),
+      m_padded_lapl(create_unique_mat()), m_scaled_lapl(create_unique_mat()),
+      m_augmented(create_unique_mat()), m_augmented_rhs(create_unique_vec()),
+      m_recycled(std::deque<Vec_unique>()),
+      m_vecpool(std::make_shared<vec_pool>()), m_warp_interpolation(WarpInterpolation::linear),
+      m_prefiltered(create_unique_vec()), m_prefilter_src(nullptr), m_prefilter_state(0),
+      m_warp_dmda(create_unique_dm()), m_warp_local(create_unique_vec()), m_warp_halo(0),
+      m_warp_halo_limit(-1), m_warp_fallback_reported(false), ephemeral_count(0)
 {
   // create "local" vectors for gradient storage, one per map dim
   for (uinteger idim = 0; idim < image.ndim() + 1; idim++)
@@ -37,20 +54,31 @@ WorkSpace::WorkSpace(const Image& image, const Map& map)
   PetscErrorCode perr = VecDuplicate(*image.local_vec(), m_localtmp.get());
   CHKERRABORT(m_comm, perr);
 
-  // create "global" vector for stack compatible with basis matrix
-  // should be compatible with all map bases of this size
-  m_stacktmp = create_unique_vec();
-  perr = MatCreateVecs(*map.basis(), nullptr, m_stacktmp.get());
-  debug_creation(*m_stacktmp, "workspace vector");
+  // create "global" vector for stack compatible with the tiled basis, the basis rows share the
+  // image layout so this should be compatible with all map bases of this size
+  Vec_unique pixels = create_unique_vec();
+  perr = MatCreateVecs(*map.basis(), nullptr, pixels.get());
   CHKERRABORT(m_comm, perr);
+  m_stacktmp = create_tiled_vec(m_comm, *pixels, image.ndim() + 1);
+  debug_creation(*m_stacktmp, "workspace vector");
 
-  create_scatterers();
   reallocate_ephemeral_workspace(map);
 }
 
 void WorkSpace::reallocate_ephemeral_workspace(const Map& map)
 {
   ephemeral_count++;
+  // solver objects and pooled temporaries are sized for the previous map
+  m_tmat = create_unique_mat();
+  m_normprod = create_unique_mat();
+  m_ksp = create_unique_ksp();
+  m_padded_lapl = create_unique_mat();
+  m_scaled_lapl = create_unique_mat();
+  m_augmented = create_unique_mat();
+  m_augmented_rhs = create_unique_vec();
+  m_recycled.clear();
+  m_vecpool->clear();
+
   // allocate rhs vec and solution storage, use existing displacements in map
   PetscErrorCode perr;
   m_delta = create_unique_vec();
@@ -62,86 +90,310 @@ void WorkSpace::reallocate_ephemeral_workspace(const Map& map)
   CHKERRABORT(m_comm, perr);
   perr = VecDuplicate(*map.m_displacements, m_rhs.get());
   CHKERRABORT(m_comm, perr);
-  debug_creation(*m_delta, std::string("rhs_storage_") + std::to_string(ephemeral_count));
+  debug_creation(*m_rhs, std::string("rhs_storage_") + std::to_string(ephemeral_count));
   perr = VecSet(*m_rhs, 0.);
   CHKERRABORT(m_comm, perr);
 }
 
-void WorkSpace::scatter_stacked_to_grads()
+Vec_shared WorkSpace::borrow_vec(const Vec& like)
 {
-  for (size_t idim = 0; idim < m_scatterers.size(); idim++)
+  integer localsize, globalsize, blocksize;
+  PetscErrorCode perr = VecGetLocalSize(like, &localsize);
+  CHKERRABORT(m_comm, perr);
+  perr = VecGetSize(like, &globalsize);
+  CHKERRABORT(m_comm, perr);
+  perr = VecGetBlockSize(like, &blocksize);
+  CHKERRABORT(m_comm, perr);
+  // Vectors of the same size can still differ in ordering, e.g natural versus PETSc ordered
+  // vectors of one DMDA, so the attached DM is part of the layout
+  DM dm;
+  perr = VecGetDM(like, &dm);
+  CHKERRABORT(m_comm, perr);
+  vec_layout layout(localsize, globalsize, blocksize, dm);
+
+  Vec_unique vec = create_unique_vec();
+  std::vector<Vec_unique>& available = (*m_vecpool)[layout];
+  if (available.empty())
   {
-    PetscErrorCode perr = VecScatterBegin(
-        *m_scatterers[idim], *m_stacktmp, *m_globaltmps[idim], INSERT_VALUES, SCATTER_REVERSE);
-    CHKERRABORT(m_comm, perr);
-    perr = VecScatterEnd(
-        *m_scatterers[idim], *m_stacktmp, *m_globaltmps[idim], INSERT_VALUES, SCATTER_REVERSE);
+    perr = VecDuplicate(like, vec.get());
     CHKERRABORT(m_comm, perr);
+    debug_creation(*vec, std::string("pooled_") + std::to_string(globalsize));
+  }
+  else
+  {
+    vec = std::move(available.back());
+    available.pop_back();
   }
+
+  std::weak_ptr<vec_pool> pool = m_vecpool;
+  return Vec_shared(vec.release(), [pool, layout](Vec* v) {
+    if (std::shared_ptr<vec_pool> p = pool.lock())
+    {
+      (*p)[layout].push_back(Vec_unique(v));
+    }
+    else
+    {
+      VecDeleter()(v);
+    }
+  });
 }
 
-void WorkSpace::scatter_grads_to_stacked()
+Vec WorkSpace::warp_source(const Image& image)
 {
-  for (size_t idim = 0; idim < m_scatterers.size(); idim++)
+  const Vec& src = *image.global_vec();
+  if (m_warp_interpolation != WarpInterpolation::cubic)
+  {
+    return src;
+  }
+
+  PetscObjectState state;
+  PetscErrorCode perr = PetscObjectStateGet(reinterpret_cast<PetscObject>(src), &state);
+  CHKERRABORT(m_comm, perr);
+  if (*m_prefiltered != nullptr && m_prefilter_src == src && m_prefilter_state == state)
+  {
+    return *m_prefiltered;
+  }
+
+  profiling::ScopedPhase phase("prefilter");
+  if (*m_prefiltered == nullptr)
+  {
+    perr = VecDuplicate(src, m_prefiltered.get());
+    CHKERRABORT(m_comm, perr);
+    debug_creation(*m_prefiltered, "bspline_coefficients");
+  }
+
+  if (ensure_warp_halo(bspline_prefilter_width))
   {
-    PetscErrorCode perr = VecScatterBegin(
-        *m_scatterers[idim], *m_globaltmps[idim], *m_stacktmp, INSERT_VALUES, SCATTER_FORWARD);
+    // One ghost exchange and one 1D pass per axis, each pass reads only the ghosted copy so it
+    // can write over its own input
+    Vec input = src;
+    for (uinteger idim = 0; idim < image.ndim(); idim++)
+    {
+      if (image.shape()[idim] == 1)
+      {
+        continue;
+      }
+      perr = DMGlobalToLocalBegin(*m_warp_dmda, input, INSERT_VALUES, *m_warp_local);
+      CHKERRABORT(m_comm, perr);
+      perr = DMGlobalToLocalEnd(*m_warp_dmda, input, INSERT_VALUES, *m_warp_local);
+      CHKERRABORT(m_comm, perr);
+      bspline_prefilter_axis(m_comm, *m_warp_dmda, *m_warp_local, idim, *m_prefiltered);
+      input = *m_prefiltered;
+    }
+    profiling::add_count("separable_prefilters");
+  }
+  else
+  {
+    // Blocks too narrow for the filter: sampling the B-spline at the pixels is the cubic warp
+    // with zero displacement, solve it for the coefficients. The mirrored boundary makes it
+    // unsymmetric, but it is diagonally dominant so GMRES with Jacobi converges in a handful of
+    // iterations.
+    std::vector<Vec_shared> zeros;
+    std::vector<Vec*> zero_ptrs;
+    for (uinteger idim = 0; idim < image.ndim(); idim++)
+    {
+      zeros.push_back(borrow_vec(src));
+      perr = VecSet(*zeros.back(), 0.);
+      CHKERRABORT(m_comm, perr);
+      zero_ptrs.push_back(zeros.back().get());
+    }
+    Mat_unique sampling = build_warp_matrix(
+        m_comm, *image.dmda(), image.shape(), image.ndim(), zero_ptrs, WarpInterpolation::cubic);
+
+    KSP_unique ksp = create_unique_ksp();
+    perr = KSPCreate(m_comm, ksp.get());
+    CHKERRABORT(m_comm, perr);
+    perr = KSPSetOperators(*ksp, *sampling, *sampling);
+    CHKERRABORT(m_comm, perr);
+    perr = KSPSetType(*ksp, KSPGMRES);
     CHKERRABORT(m_comm, perr);
-    perr = VecScatterEnd(
-        *m_scatterers[idim], *m_globaltmps[idim], *m_stacktmp, INSERT_VALUES, SCATTER_FORWARD);
+    PC pc;
+    perr = KSPGetPC(*ksp, &pc);
+    CHKERRABORT(m_comm, perr);
+    perr = PCSetType(pc, PCJACOBI);
+    CHKERRABORT(m_comm, perr);
+    perr = KSPSetTolerances(*ksp, 1e-6, PETSC_DEFAULT, PETSC_DEFAULT, PETSC_DEFAULT);
+    CHKERRABORT(m_comm, perr);
+    perr = KSPSetOptionsPrefix(*ksp, "prefilter_");
+    CHKERRABORT(m_comm, perr);
+    perr = KSPSetFromOptions(*ksp);
+    CHKERRABORT(m_comm, perr);
+    perr = KSPSolve(*ksp, src, *m_prefiltered);
     CHKERRABORT(m_comm, perr);
   }
+
+  m_prefilter_src = src;
+  m_prefilter_state = state;
+  return *m_prefiltered;
 }
 
-void WorkSpace::duplicate_single_grad_to_stacked(size_t idx)
+bool WorkSpace::warp_halo(const Image& image, const std::vector<Vec*>& displacements, Vec tgt)
 {
-  for (size_t idim = 0; idim < m_scatterers.size(); idim++)
+  // Every sample lies within the largest displacement of its pixel, plus the kernel support
+  double maxdisp = 0.;
+  for (uinteger idim = 0; idim < image.ndim(); idim++)
   {
-    PetscErrorCode perr = VecScatterBegin(
-        *m_scatterers[idim], *m_globaltmps[idx], *m_stacktmp, INSERT_VALUES, SCATTER_FORWARD);
+    const floating* ptr;
+    integer localsize;
+    PetscErrorCode perr = VecGetLocalSize(*displacements[idim], &localsize);
+    CHKERRABORT(m_comm, perr);
+    perr = VecGetArrayRead(*displacements[idim], &ptr);
     CHKERRABORT(m_comm, perr);
-    perr = VecScatterEnd(
-        *m_scatterers[idim], *m_globaltmps[idx], *m_stacktmp, INSERT_VALUES, SCATTER_FORWARD);
+    for (integer idx = 0; idx < localsize; idx++)
+    {
+      maxdisp = std::max(maxdisp, static_cast<double>(std::fabs(ptr[idx])));
+    }
+    perr = VecRestoreArrayRead(*displacements[idim], &ptr);
     CHKERRABORT(m_comm, perr);
   }
+  FusedReduction reduction(m_comm);
+  size_t max_idx = reduction.add_max(maxdisp);
+  reduction.reduce();
+  integer width = static_cast<integer>(std::ceil(reduction.result(max_idx))) + 2;
+
+  if (!ensure_warp_halo(width))
+  {
+    if (!m_warp_fallback_reported)
+    {
+      PetscPrintf(m_comm, "Displacements of up to %.1f pixels are wider than the largest "
+          "possible halo, warping with an assembled matrix\n", reduction.result(max_idx));
+      m_warp_fallback_reported = true;
+    }
+    return false;
+  }
+
+  Vec src = warp_source(image);
+  PetscErrorCode perr = DMGlobalToLocalBegin(*m_warp_dmda, src, INSERT_VALUES, *m_warp_local);
+  CHKERRABORT(m_comm, perr);
+  perr = DMGlobalToLocalEnd(*m_warp_dmda, src, INSERT_VALUES, *m_warp_local);
+  CHKERRABORT(m_comm, perr);
+  warp_ghosted(m_comm, *m_warp_dmda, *m_warp_local, image.ndim(), displacements,
+      m_warp_interpolation, tgt);
+  return true;
 }
 
-void WorkSpace::create_scatterers()
+bool WorkSpace::ensure_warp_halo(integer width)
 {
-  AO ao_petsctonat; // N.B this is not going to be a leak, we are just borrowing a Petsc managed
-                    // obj.
-  PetscErrorCode perr = DMDAGetAO(*m_dmda, &ao_petsctonat); // Destroying this would break the dmda
+  if (m_warp_halo >= width)
+  {
+    return true;
+  }
+
+  integer ndim, procs[3], shape[3];
+  PetscErrorCode perr = DMDAGetInfo(*m_dmda, &ndim, &shape[0], &shape[1], &shape[2], &procs[0],
+      &procs[1], &procs[2], nullptr, nullptr, nullptr, nullptr, nullptr, nullptr);
   CHKERRABORT(m_comm, perr);
+  const integer* ranges[3];
+  perr = DMDAGetOwnershipRanges(*m_dmda, &ranges[0], &ranges[1], &ranges[2]);
+  CHKERRABORT(m_comm, perr);
+  if (m_warp_halo_limit < 0)
+  {
+    // PETSc needs every block along a split dimension to be at least the stencil width
+    m_warp_halo_limit = std::numeric_limits<integer>::max();
+    for (uinteger idim = 0; idim < 3; idim++)
+    {
+      if (procs[idim] > 1)
+      {
+        m_warp_halo_limit = std::min(
+            m_warp_halo_limit, *std::min_element(ranges[idim], ranges[idim] + procs[idim]));
+      }
+    }
+  }
+  if (width > m_warp_halo_limit)
+  {
+    return false;
+  }
 
-  integer offset = 0; // Track offset
-  for (auto&& pp_grad : m_globaltmps)
+  // At least the prefilter width, so the prefilter and later small warps share one DMDA
+  width = std::min(std::max(width, bspline_prefilter_width), m_warp_halo_limit);
+  m_warp_dmda = create_unique_dm();
+  if (shape[2] == 1)
   {
-    // Get extents of local data in grad array
-    integer startelem, datasize;
-    perr = VecGetOwnershipRange(*pp_grad, &startelem, &datasize);
-    CHKERRABORT(m_comm, perr);
-    datasize -= startelem;
+    // A 3D DMDA would also carry the halo above and below a 2D image
+    perr = DMDACreate2d(m_comm, DM_BOUNDARY_GHOSTED, DM_BOUNDARY_GHOSTED, DMDA_STENCIL_BOX,
+        shape[0], shape[1], procs[0], procs[1], 1, width, ranges[0], ranges[1],
+        m_warp_dmda.get());
+  }
+  else
+  {
+    perr = DMDACreate3d(m_comm, DM_BOUNDARY_GHOSTED, DM_BOUNDARY_GHOSTED, DM_BOUNDARY_GHOSTED,
+        DMDA_STENCIL_BOX, shape[0], shape[1], shape[2], procs[0], procs[1], procs[2], 1, width,
+        ranges[0], ranges[1], ranges[2], m_warp_dmda.get());
+  }
+  CHKERRABORT(m_comm, perr);
+  perr = DMSetUp(*m_warp_dmda);
+  CHKERRABORT(m_comm, perr);
+  m_warp_local = create_unique_vec();
+  perr = DMCreateLocalVector(*m_warp_dmda, m_warp_local.get());
+  CHKERRABORT(m_comm, perr);
+  debug_creation(*m_warp_local, std::string("warp_halo_") + std::to_string(width));
+  m_warp_halo = width;
+  return true;
+}
 
-    // Create IS for source indices in stacked array, keep in vector for memory management
-    m_iss.push_back(create_unique_is());
-    IS* p_src_is = m_iss.back().get(); // grab a temp copy to avoid vector accesses below
-    perr = ISCreateStride(m_comm, datasize, startelem, 1, p_src_is);
+void WorkSpace::scatter_stacked_to_grads()
+{
+  const floating* stackptr;
+  PetscErrorCode perr = VecGetArrayRead(*m_stacktmp, &stackptr);
+  CHKERRABORT(m_comm, perr);
+  const floating* src = stackptr;
+  for (auto const& grad : m_globaltmps)
+  {
+    floating* gradptr;
+    integer localsize;
+    perr = VecGetLocalSize(*grad, &localsize);
     CHKERRABORT(m_comm, perr);
-    // Convert with AO to map from petsc to natural ordering (do here because tgt_is is offset)
-    perr = AOApplicationToPetscIS(ao_petsctonat, *m_iss.back());
+    perr = VecGetArray(*grad, &gradptr);
     CHKERRABORT(m_comm, perr);
-
-    m_iss.push_back(create_unique_is());
-    IS* p_tgt_is = m_iss.back().get(); // grab a temp copy to avoid vector accesses below
-    perr = ISCreateStride(m_comm, datasize, startelem + offset, 1, p_tgt_is);
+    std::copy_n(src, localsize, gradptr);
+    src += localsize;
+    perr = VecRestoreArray(*grad, &gradptr);
     CHKERRABORT(m_comm, perr);
+  }
+  perr = VecRestoreArrayRead(*m_stacktmp, &stackptr);
+  CHKERRABORT(m_comm, perr);
+}
 
-    // Create scatterer and add to array
-    m_scatterers.push_back(create_unique_vecscatter());
-    perr =
-        VecScatterCreate(*pp_grad, *p_src_is, *m_stacktmp, *p_tgt_is, m_scatterers.back().get());
+void WorkSpace::scatter_grads_to_stacked()
+{
+  floating* stackptr;
+  PetscErrorCode perr = VecGetArray(*m_stacktmp, &stackptr);
+  CHKERRABORT(m_comm, perr);
+  floating* tgt = stackptr;
+  for (auto const& grad : m_globaltmps)
+  {
+    const floating* gradptr;
+    integer localsize;
+    perr = VecGetLocalSize(*grad, &localsize);
+    CHKERRABORT(m_comm, perr);
+    perr = VecGetArrayRead(*grad, &gradptr);
+    CHKERRABORT(m_comm, perr);
+    tgt = std::copy_n(gradptr, localsize, tgt);
+    perr = VecRestoreArrayRead(*grad, &gradptr);
     CHKERRABORT(m_comm, perr);
+  }
+  perr = VecRestoreArray(*m_stacktmp, &stackptr);
+  CHKERRABORT(m_comm, perr);
+}
 
-    offset += m_size;
+void WorkSpace::duplicate_single_grad_to_stacked(size_t idx)
+{
+  floating* stackptr;
+  PetscErrorCode perr = VecGetArray(*m_stacktmp, &stackptr);
+  CHKERRABORT(m_comm, perr);
+  const floating* gradptr;
+  integer localsize;
+  perr = VecGetLocalSize(*m_globaltmps[idx], &localsize);
+  CHKERRABORT(m_comm, perr);
+  perr = VecGetArrayRead(*m_globaltmps[idx], &gradptr);
+  CHKERRABORT(m_comm, perr);
+  floating* tgt = stackptr;
+  for (size_t tile = 0; tile < m_globaltmps.size(); tile++)
+  {
+    tgt = std::copy_n(gradptr, localsize, tgt);
   }
+  perr = VecRestoreArrayRead(*m_globaltmps[idx], &gradptr);
+  CHKERRABORT(m_comm, perr);
+  perr = VecRestoreArray(*m_stacktmp, &stackptr);
+  CHKERRABORT(m_comm, perr);
 }
@@ -16,6 +16,11 @@
 #ifndef WORKSPACE_HPP
 #define WORKSPACE_HPP
 
+#include <deque>
+#include <map>
+#include <tuple>
+#include <utility>
+
 #include "elastic.hpp"
 #include "image.hpp"
 #include "types.hpp"
@@ -25,27 +30,67 @@ public:
   WorkSpace(const Image& image, const Map& map);
 
   void reallocate_ephemeral_workspace(const Map& map);
+  // The stacked vector holds each rank's part of every gradient vector in turn, so moving
+  // between them is a local copy
   void scatter_stacked_to_grads();
   void scatter_grads_to_stacked();
   void duplicate_single_grad_to_stacked(size_t idx);
 
+  // Borrow a temporary with the same parallel layout as like, contents are undefined. It returns
+  // to the pool when the last reference is dropped.
+  Vec_shared borrow_vec(const Vec& like);
+
+  // Vector the warp samples. For cubic interpolation these are the B-spline coefficients of the
+  // image, cached until the image data changes.
+  Vec warp_source(const Image& image);
+
+  // Warp image by the displacements into tgt on the ghosted local array. False, with tgt
+  // untouched, if the displacements need a wider halo than the decomposition allows.
+  bool warp_halo(const Image& image, const std::vector<Vec*>& displacements, Vec tgt);
+
   friend Elastic;
   friend Map;
 
   //  protected:
 
   void allocate_persistent_workspace();
-  void create_scatterers();
+  // Make sure the warp DMDA has ghost regions at least width wide, false if no rank's block is
+  // wide enough for that
+  bool ensure_warp_halo(integer width);
 
   MPI_Comm m_comm;
   DM_shared m_dmda;
   integer m_size;
   std::vector<Vec_unique> m_globaltmps;
-  std::vector<IS_unique> m_iss;
-  std::vector<VecScatter_unique> m_scatterers;
   Vec_unique m_stacktmp, m_localtmp;
   Vec_unique m_delta, m_rhs;
-  Mat_unique m_tmat;
+  // Per-generation solver objects, reused across iterations and released when the map changes
+  Mat_unique m_tmat, m_normprod;
+  KSP_unique m_ksp;
+  // L^T L padded with zeros to the pattern of one diagonal block of the normal matrix
+  Mat_unique m_padded_lapl;
+  // Least squares operator [T S; sqrt(lambda) L] and its right hand side [r; 0]
+  Mat_unique m_scaled_lapl, m_augmented;
+  Vec_unique m_augmented_rhs;
+  // Most recent solutions of the generation, oldest first, for krylov_recycle
+  std::deque<Vec_unique> m_recycled;
+
+  // Free temporaries keyed by (local size, global size, block size, DM), shared so that vectors
+  // still borrowed when the workspace is destroyed can tell the pool has gone
+  using vec_layout = std::tuple<integer, integer, integer, DM>;
+  using vec_pool = std::map<vec_layout, std::vector<Vec_unique>>;
+  std::shared_ptr<vec_pool> m_vecpool;
+
+  WarpInterpolation m_warp_interpolation;
+  Vec_unique m_prefiltered;
+  Vec m_prefilter_src;
+  PetscObjectState m_prefilter_state;
+  // Image layout with a wide box stencil for warping and prefiltering, grown as needed. The
+  // widest halo PETSc allows is the narrowest split block, -1 until known.
+  DM_unique m_warp_dmda;
+  Vec_unique m_warp_local;
+  integer m_warp_halo, m_warp_halo_limit;
+  bool m_warp_fallback_reported;
 
   integer ephemeral_count;
 };
@@ -0,0 +1,60 @@
+#define BOOST_TEST_MODULE configuration
+#include "test_common.hpp"
+
+#include <petscsys.h>
+
+#include "types.hpp"
+#include "dictconfiguration.hpp"
+#include "setup.hpp"
+
+BOOST_AUTO_TEST_SUITE(configuration)
+
+  BOOST_AUTO_TEST_CASE(test_petsc_sections)
+  {
+    DictConfig config({});
+    config.set_petsc("petsc", "ksp_type", "gmres");
+    config.set_petsc("petsc", "--pc_type", "bjacobi");
+    config.set_petsc("petsc.gen2", "-ksp_rtol", "1e-3");
+    config.set_petsc("petsc.gen10", "ksp_monitor", "");
+
+    config_map expected = {{"-ksp_type", "gmres"}, {"-pc_type", "bjacobi"},
+        {"-gen2_ksp_rtol", "1e-3"}, {"-gen10_ksp_monitor", ""}};
+    BOOST_CHECK(config.petsc_options() == expected);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_petsc_bad_sections)
+  {
+    DictConfig config({});
+    BOOST_CHECK_THROW(config.set_petsc("petsc.gen", "ksp_type", "cg"), std::runtime_error);
+    BOOST_CHECK_THROW(config.set_petsc("petsc.gen2a", "ksp_type", "cg"), std::runtime_error);
+    BOOST_CHECK_THROW(config.set_petsc("petsc.gen-1", "ksp_type", "cg"), std::runtime_error);
+    BOOST_CHECK_THROW(config.set_petsc("petsc.other", "ksp_type", "cg"), std::runtime_error);
+    BOOST_CHECK_THROW(config.set_petsc("petscgen1", "ksp_type", "cg"), std::runtime_error);
+    BOOST_CHECK_THROW(config.set_petsc("petsc", "--", "cg"), std::runtime_error);
+    BOOST_TEST(config.petsc_options().empty());
+  }
+
+  BOOST_AUTO_TEST_CASE(test_petsc_existing_options_win)
+  {
+    // Options already in the database, e.g from the command line, are not overwritten
+    PetscErrorCode perr = PetscOptionsSetValue(nullptr, "-test_config_existing", "command");
+    CHKERRXX(perr);
+    DictConfig config({});
+    config.set_petsc("petsc", "test_config_existing", "config");
+    config.set_petsc("petsc", "test_config_new", "config");
+    apply_petsc_options(config);
+
+    char value[64];
+    PetscBool set;
+    perr = PetscOptionsGetString(
+        nullptr, nullptr, "-test_config_existing", value, sizeof(value), &set);
+    CHKERRXX(perr);
+    BOOST_TEST(set);
+    BOOST_TEST(std::string(value) == "command");
+    perr = PetscOptionsGetString(nullptr, nullptr, "-test_config_new", value, sizeof(value), &set);
+    CHKERRXX(perr);
+    BOOST_TEST(set);
+    BOOST_TEST(std::string(value) == "config");
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,67 @@
+#define BOOST_TEST_MODULE decomposition
+#include "test_common.hpp"
+
+#include <numeric>
+
+#include "types.hpp"
+#include "decomposition.hpp"
+
+BOOST_AUTO_TEST_SUITE(decomposition_suite)
+
+  BOOST_AUTO_TEST_CASE(test_even_ownership)
+  {
+    intvector owned = decomposition::even_ownership(10, 4);
+    BOOST_TEST(owned == intvector({3, 3, 2, 2}), boost::test_tools::per_element());
+  }
+
+  BOOST_AUTO_TEST_CASE(test_balanced_grid_2d)
+  {
+    // 2D image must not be split in z, long axis gets the most ranks
+    intvector shape = {512, 128, 1};
+    decomposition::GridPartition part = decomposition::balanced_partition(shape, 8);
+    BOOST_TEST(part.procs == intvector({8, 1, 1}), boost::test_tools::per_element());
+  }
+
+  BOOST_AUTO_TEST_CASE(test_balanced_grid_odd_ranks)
+  {
+    intvector shape = {100, 90, 80};
+    decomposition::GridPartition part = decomposition::balanced_partition(shape, 15);
+    BOOST_TEST(part.procs[0] * part.procs[1] * part.procs[2] == 15);
+    for (uinteger idim = 0; idim < 3; idim++)
+    {
+      BOOST_TEST(static_cast<integer>(part.ownership[idim].size()) == part.procs[idim]);
+      BOOST_TEST(std::accumulate(part.ownership[idim].cbegin(), part.ownership[idim].cend(),
+                                 integer(0)) == shape[idim]);
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(test_no_fitting_grid)
+  {
+    // More ranks than points, PETSc is left to fail or decide
+    intvector shape = {2, 2, 1};
+    decomposition::GridPartition part = decomposition::balanced_partition(shape, 7);
+    BOOST_TEST(part.procs[0] == PETSC_DECIDE);
+    BOOST_TEST(part.ownership_ptr(0) == nullptr);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_topology_grid)
+  {
+    // Balanced choice is 1x3x4, which splits nodes of 4 ranks across planes. 1x4x3 gives each
+    // node a whole plane for a slightly larger per-rank block.
+    intvector shape = {120, 120, 120};
+    decomposition::GridPartition balanced = decomposition::balanced_partition(shape, 12);
+    BOOST_TEST(balanced.procs == intvector({1, 3, 4}), boost::test_tools::per_element());
+    decomposition::GridPartition part = decomposition::topology_partition(shape, 12, 4);
+    BOOST_TEST(part.procs == intvector({1, 4, 3}), boost::test_tools::per_element());
+  }
+
+  BOOST_AUTO_TEST_CASE(test_topology_single_rank_nodes)
+  {
+    // One rank per node has no on-node halo to gain, same as balanced
+    intvector shape = {100, 90, 80};
+    decomposition::GridPartition balanced = decomposition::balanced_partition(shape, 15);
+    decomposition::GridPartition part = decomposition::topology_partition(shape, 15, 1);
+    BOOST_TEST(part.procs == balanced.procs, boost::test_tools::per_element());
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -165,4 +165,44 @@ BOOST_FIXTURE_TEST_SUITE(indexing, im)
     }//gradient checking enclosure
   }
 
+  BOOST_AUTO_TEST_CASE(test_overlapped_gradient)
+  {
+    // Interior/boundary split must match the single pass gradient, on an image large enough to
+    // have an interior on every rank
+    PetscErrorCode perr;
+    Image bigimage({9, 8, 7});
+    integer xlo, xhi, ylo, yhi, zlo, zhi;
+    perr = DMDAGetCorners(*bigimage.dmda(), &xlo, &ylo, &zlo, &xhi, &yhi, &zhi);CHKERRXX(perr);
+    xhi += xlo;
+    yhi += ylo;
+    zhi += zlo;
+    {//image setting enclosure
+    floating ***ptr;
+    perr = DMDAVecGetArray(*bigimage.dmda(), *bigimage.global_vec(), &ptr);CHKERRXX(perr);
+    for(integer xx=xlo; xx<xhi; xx++)
+    {
+      for(integer yy=ylo; yy<yhi; yy++)
+      {
+        for(integer zz=zlo; zz<zhi; zz++)
+        {
+          ptr[zz][yy][xx] = xx*xx + 2*yy*zz - 3*zz;
+        }
+      }
+    }
+    perr = DMDAVecRestoreArray(*bigimage.dmda(), *bigimage.global_vec(), &ptr);CHKERRXX(perr);
+    }//image setting enclosure
+
+    for(integer dim=0; dim<3; dim++)
+    {
+      Vec_unique split = bigimage.gradient(dim);
+      bigimage.update_local_from_global();
+      Vec_unique single = fd::gradient_to_global_unique(*bigimage.dmda(), *bigimage.local_vec(),
+                                                        dim);
+      perr = VecAXPY(*split, -1., *single);CHKERRXX(perr);
+      floating diff;
+      perr = VecNorm(*split, NORM_INFINITY, &diff);CHKERRXX(perr);
+      BOOST_CHECK_EQUAL(diff, 0.);
+    }
+  }
+
 BOOST_AUTO_TEST_SUITE_END()
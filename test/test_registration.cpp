@@ -0,0 +1,283 @@
+#define BOOST_TEST_MODULE registration
+#include "test_common.hpp"
+
+#include <functional>
+#include <map>
+
+#include <petscvec.h>
+
+#include "types.hpp"
+#include "dictconfiguration.hpp"
+#include "elastic.hpp"
+#include "image.hpp"
+#include "map.hpp"
+#include "profiling.hpp"
+#include "synthetic.hpp"
+#include "workspace.hpp"
+
+// End to end accuracy checks: a known displacement field is applied to a synthetic pattern with
+// Map::warp and the registration must recover it. Tolerances are deliberately loose, these are
+// to catch a broken solver or warp rather than to grade accuracy.
+
+namespace
+{
+floating image_residual(const Image& a, const Image& b)
+{
+  Vec_unique diff = create_unique_vec();
+  PetscErrorCode perr = VecDuplicate(*a.global_vec(), diff.get());CHKERRXX(perr);
+  perr = VecWAXPY(*diff, -1.0, *b.global_vec(), *a.global_vec());CHKERRXX(perr);
+  floating norm;
+  perr = VecNorm(*diff, NORM_2, &norm);CHKERRXX(perr);
+  return norm;
+}
+
+// Counters and phase calls of the last run, zero if never recorded
+integer counted(const std::string& name)
+{
+  const profiling::counter_map& counts = profiling::counters();
+  auto it = counts.find(name);
+  return it == counts.end() ? 0 : it->second;
+}
+
+integer phase_calls(const std::string& name)
+{
+  const profiling::phase_map& phases = profiling::phases();
+  auto it = phases.find(name);
+  return it == phases.end() ? 0 : it->second.calls;
+}
+
+struct RegistrationCase
+{
+  RegistrationCase(const intvector& shape, const displacement_field& field,
+                   floating fieldspacing = 1)
+    : moved(synthetic_image(shape))
+  {
+    // Apply the field with the same warp the registration uses
+    floatvector spacing(moved->ndim(), fieldspacing);
+    if (spacing.size() == 2)
+    {
+      spacing.push_back(1);
+    }
+    Map fieldmap(*moved, spacing);
+    set_map_displacements(fieldmap, field);
+    WorkSpace wksp(*moved, fieldmap);
+    fixed = fieldmap.warp(*moved, wksp);
+  }
+
+  // Register and return (map rms error, residual after / residual before)
+  std::pair<floating, floating> run(floating nodespacing, const displacement_field& field,
+                                    const config_map& options = config_map())
+  {
+    fixed->normalize();
+    moved->normalize();
+    DictConfig config({{"fixed", "synthetic"}, {"moved", "synthetic"},
+        {"nodespacing", std::to_string(nodespacing)}});
+    for (const auto& it : options)
+    {
+      config.set(it.first, it.second);
+    }
+    Elastic reg(*fixed, *moved, floatvector(fixed->ndim(), nodespacing), config);
+    reg.autoregister();
+    tuned_ksp = reg.m_tuned_ksp;
+    pixel_error = pixel_rms_error(*reg.m_p_map, *fixed, field);
+
+    floating before = image_residual(*fixed, *moved);
+    floating after = image_residual(*fixed, *reg.registered());
+    return std::make_pair(map_rms_error(*reg.m_p_map, field), after / before);
+  }
+
+  std::unique_ptr<Image> moved;
+  std::unique_ptr<Image> fixed;
+  // KSP type chosen by autotune in the last run, empty if it did not run
+  std::string tuned_ksp;
+  // RMS error of the displacement interpolated at the pixels in the last run
+  floating pixel_error = 0;
+};
+
+// Options to run the sinusoid registration with, and a check that they had an effect
+struct OptionCase
+{
+  std::string name;
+  config_map options;
+  std::function<void(const RegistrationCase&)> check;
+};
+} // anonymous namespace
+
+BOOST_AUTO_TEST_SUITE(registration)
+
+  BOOST_AUTO_TEST_CASE(test_warp_matches_analytic)
+  {
+    // Warping through a pixel spaced map must agree with sampling the pattern directly, up to
+    // linear interpolation error
+    intvector shape = {64, 64};
+    displacement_field field = sinusoidal_field(shape, 2.0);
+    RegistrationCase rc(shape, field);
+    std::unique_ptr<Image> analytic = synthetic_image(shape, field);
+    floating rel = image_residual(*rc.fixed, *analytic) / image_residual(*rc.fixed, *rc.moved);
+    BOOST_TEST(rel < 0.1);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_recover_translation)
+  {
+    intvector shape = {64, 64};
+    displacement_field field = translation_field({1.5, -1.0});
+    RegistrationCase rc(shape, field);
+    floating maperr, residual;
+    std::tie(maperr, residual) = rc.run(8, field);
+    BOOST_TEST(maperr < 0.5);
+    BOOST_TEST(residual < 0.3);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_recover_sinusoid_options)
+  {
+    // Every solver option set must still recover the field, and the counters must show that
+    // the option changed what the solver actually did
+    intvector shape = {64, 64};
+    displacement_field field = sinusoidal_field(shape, 2.0);
+    const std::vector<OptionCase> cases = {
+        {"default", {}, [](const RegistrationCase&) { BOOST_TEST(counted("direct_solves") > 0); }},
+        {"iterative", {{"direct_solve_size", "0"}},
+            [](const RegistrationCase&) { BOOST_TEST(counted("direct_solves") == 0); }},
+        {"recycled", {{"direct_solve_size", "0"}, {"krylov_recycle", "4"}},
+            [](const RegistrationCase&) { BOOST_TEST(phase_calls("recycle") > 0); }},
+        {"lagged_operator", {{"operator_lag", "3"}},
+            [](const RegistrationCase&) {
+              BOOST_TEST(counted("operator_builds") < counted("iterations"));
+            }},
+        {"compositional", {{"map_update", "compositional"}},
+            [](const RegistrationCase&) { BOOST_TEST(phase_calls("compose") > 0); }},
+        {"lsqr", {{"solver", "lsqr"}},
+            [](const RegistrationCase&) {
+              BOOST_TEST(phase_calls("least_squares") > 0);
+              BOOST_TEST(counted("operator_builds") == 0);
+            }},
+        {"line_search", {{"line_search", "true"}, {"inexact_newton", "true"}},
+            [](const RegistrationCase&) {
+              BOOST_TEST(counted("line_search_trials") >= counted("iterations"));
+            }},
+        {"autotune", {{"autotune", "true"}},
+            [](const RegistrationCase& rc) {
+              BOOST_TEST(counted("autotune_trials") > 0);
+              BOOST_TEST(!rc.tuned_ksp.empty());
+            }},
+    };
+
+    std::map<std::string, floating> its_per_solve;
+    for (const auto& ocase : cases)
+    {
+      BOOST_TEST_CONTEXT(ocase.name)
+      {
+        RegistrationCase rc(shape, field);
+        profiling::reset();
+        floating maperr, residual;
+        std::tie(maperr, residual) = rc.run(8, field, ocase.options);
+        BOOST_TEST(maperr < 0.6);
+        BOOST_TEST(residual < 0.3);
+        if (ocase.check)
+        {
+          ocase.check(rc);
+        }
+        its_per_solve[ocase.name] =
+            static_cast<floating>(counted("ksp_iterations")) / counted("iterations");
+      }
+    }
+    // the recycled initial guess must cut the Krylov work, not just be harmless
+    BOOST_TEST(its_per_solve["recycled"] < its_per_solve["iterative"]);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_recover_sinusoid_symmetric_scaling)
+  {
+    intvector shape = {64, 64};
+    displacement_field field = sinusoidal_field(shape, 2.0);
+    RegistrationCase rc(shape, field);
+    profiling::reset();
+    floating maperr, residual;
+    std::tie(maperr, residual) =
+        rc.run(8, field, {{"symmetric_scaling", "true"}, {"direct_solve_size", "0"}});
+    BOOST_TEST(maperr < 0.6);
+    BOOST_TEST(residual < 0.3);
+    BOOST_TEST(counted("symmetric_scalings") > 0);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_recover_sinusoid_fieldsplit)
+  {
+    intvector shape = {64, 64};
+    displacement_field field = sinusoidal_field(shape, 2.0);
+    for (const std::string split : {"multiplicative", "schur"})
+    {
+      RegistrationCase rc(shape, field);
+      profiling::reset();
+      floating maperr, residual;
+      std::tie(maperr, residual) = rc.run(8, field, {{"fieldsplit", split}});
+      BOOST_TEST(maperr < 0.6);
+      BOOST_TEST(residual < 0.3);
+      BOOST_TEST(counted("fieldsplit_solves") > 0);
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(test_recover_sinusoid_cubic)
+  {
+    intvector shape = {64, 64};
+    displacement_field field = sinusoidal_field(shape, 2.0);
+    RegistrationCase rc(shape, field);
+    profiling::reset();
+    floating residual;
+    std::tie(std::ignore, residual) = rc.run(8, field, {{"basis_type", "cubic"}});
+    // cubic node values are spline coefficients, so compare the displacement they interpolate
+    BOOST_TEST(rc.pixel_error < 0.6);
+    BOOST_TEST(residual < 0.3);
+    BOOST_TEST(counted("cubic_basis_builds") > 0);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_compositional_cubic_rejected)
+  {
+    // Composing resamples nodal displacements, B-spline coefficients are not displacements
+    intvector shape = {64, 64};
+    displacement_field field = sinusoidal_field(shape, 2.0);
+    RegistrationCase rc(shape, field);
+    BOOST_CHECK_THROW(
+        rc.run(8, field, {{"map_update", "compositional"}, {"basis_type", "cubic"}}),
+        std::runtime_error);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_recover_sinusoid_higher_order_warp)
+  {
+    intvector shape = {64, 64};
+    displacement_field field = sinusoidal_field(shape, 2.0);
+    for (const std::string interp : {"cubic", "sinc"})
+    {
+      RegistrationCase rc(shape, field);
+      profiling::reset();
+      floating maperr, residual;
+      std::tie(maperr, residual) = rc.run(8, field, {{"warp_interpolation", interp}});
+      BOOST_TEST(maperr < 0.6);
+      BOOST_TEST(residual < 0.3);
+      // small displacements always fit the halo, the kernel in use shows in its own counter
+      BOOST_TEST(counted("matrix_warps") == 0);
+      BOOST_TEST(counted(interp == "cubic" ? "separable_prefilters" : "sinc_warps") > 0);
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(test_recover_bump)
+  {
+    intvector shape = {64, 64};
+    displacement_field field = bump_field({32, 32}, 3.0, 10.0);
+    RegistrationCase rc(shape, field);
+    floating maperr, residual;
+    std::tie(maperr, residual) = rc.run(8, field);
+    BOOST_TEST(maperr < 0.6);
+    BOOST_TEST(residual < 0.4);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_recover_sinusoid_3d)
+  {
+    intvector shape = {24, 24, 24};
+    displacement_field field = sinusoidal_field(shape, 1.0);
+    RegistrationCase rc(shape, field, 2);
+    floating maperr, residual;
+    std::tie(maperr, residual) = rc.run(6, field);
+    BOOST_TEST(maperr < 0.5);
+    BOOST_TEST(residual < 0.4);
+  }
+
+BOOST_AUTO_TEST_SUITE_END()
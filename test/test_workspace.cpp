@@ -4,8 +4,10 @@
 #include<petscdmda.h>
 
 #include "types.hpp"
+#include "basis.hpp"
 #include "image.hpp"
 #include "map.hpp"
+#include "petsc_helpers.hpp"
 #include "workspace.hpp"
 
 struct envobjs
@@ -30,28 +32,153 @@ BOOST_FIXTURE_TEST_SUITE(indexing, envobjs)
       VecAssemblyEnd(*workspace.m_globaltmps[idx]);
     }
     workspace.scatter_grads_to_stacked();
-    integer offset = 0;
-    for(size_t idx=0; idx<workspace.m_globaltmps.size(); idx++)
+    // each rank holds every component of its pixels, one after another
+    integer ntiles = workspace.m_globaltmps.size();
+    integer localsize;
+    PetscErrorCode perr = VecGetLocalSize(*workspace.m_stacktmp, &localsize);CHKERRXX(perr);
+    BOOST_REQUIRE_EQUAL(localsize % ntiles, 0);
+    integer tilesize = localsize / ntiles;
+    const floating* data;
+    perr = VecGetArrayRead(*workspace.m_stacktmp, &data);CHKERRXX(perr);
+    for(integer idx=0; idx<ntiles; idx++)
+    {
+      BOOST_CHECK(std::all_of(data + idx*tilesize, data + (idx+1)*tilesize,
+                              [idx](floating x) -> bool{return x == floating(idx);}));
+    }
+    perr = VecRestoreArrayRead(*workspace.m_stacktmp, &data);CHKERRXX(perr);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_tile_matrix_refresh)
+  {
+    // refreshing the values in place must give the same matrix as tiling from scratch
+    integer ntiles = map.m_ndim + 1;
+    Mat_unique scalar = create_unique_mat();
+    PetscErrorCode perr = MatDuplicate(*map.basis(), MAT_COPY_VALUES, scalar.get());CHKERRXX(perr);
+    Mat_unique tiled = create_unique_mat();
+    tile_matrix(PETSC_COMM_WORLD, *scalar, ntiles, tiled);
+
+    // row dependent scaling so every tile row changes differently
+    Vec_unique rowscale = create_unique_vec();
+    perr = MatCreateVecs(*scalar, nullptr, rowscale.get());CHKERRXX(perr);
+    integer rowstart, rowend;
+    perr = VecGetOwnershipRange(*rowscale, &rowstart, &rowend);CHKERRXX(perr);
+    floating* ptr;
+    perr = VecGetArray(*rowscale, &ptr);CHKERRXX(perr);
+    for(integer row=rowstart; row<rowend; row++)
+    {
+      ptr[row - rowstart] = 1 + row % 7;
+    }
+    perr = VecRestoreArray(*rowscale, &ptr);CHKERRXX(perr);
+    perr = MatDiagonalScale(*scalar, *rowscale, nullptr);CHKERRXX(perr);
+    tile_matrix(PETSC_COMM_WORLD, *scalar, ntiles, tiled);
+    Mat_unique fresh = create_unique_mat();
+    tile_matrix(PETSC_COMM_WORLD, *scalar, ntiles, fresh);
+
+    perr = MatAXPY(*fresh, -1.0, *tiled, SAME_NONZERO_PATTERN);CHKERRXX(perr);
+    floating diff, norm;
+    perr = MatNorm(*fresh, NORM_FROBENIUS, &diff);CHKERRXX(perr);
+    perr = MatNorm(*tiled, NORM_FROBENIUS, &norm);CHKERRXX(perr);
+    BOOST_TEST(norm > 0);
+    BOOST_TEST(diff == 0);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_borrow_vec_layout)
+  {
+    // a returned temporary is only handed out again for a vector of the same layout
+    const Vec& global = *image.global_vec();
+    Vec_shared borrowed = workspace.borrow_vec(global);
+    Vec first = *borrowed;
+    borrowed.reset();
+
+    integer localsize;
+    PetscErrorCode perr = VecGetLocalSize(global, &localsize);CHKERRXX(perr);
+    Vec_unique plain = create_unique_vec();
+    perr = VecCreateMPI(PETSC_COMM_WORLD, localsize, PETSC_DETERMINE, plain.get());CHKERRXX(perr);
+    Vec_shared other = workspace.borrow_vec(*plain);
+    BOOST_TEST(*other != first);
+
+    Vec_shared again = workspace.borrow_vec(global);
+    BOOST_TEST(*again == first);
+  }
+
+  BOOST_AUTO_TEST_CASE(test_halo_warp_matches_matrix)
+  {
+    // smooth image and displacements of up to a couple of pixels
+    const Vec& imgvec = *image.global_vec();
+    integer localsize;
+    PetscErrorCode perr = VecGetLocalSize(imgvec, &localsize);CHKERRXX(perr);
+    floating* ptr;
+    perr = VecGetArray(imgvec, &ptr);CHKERRXX(perr);
+    for(integer idx=0; idx<localsize; idx++)
+    {
+      ptr[idx] = std::sin(0.7*idx) + 0.1*idx;
+    }
+    perr = VecRestoreArray(imgvec, &ptr);CHKERRXX(perr);
+    std::vector<Vec*> disps;
+    for(uinteger idim=0; idim<image.ndim(); idim++)
     {
-      integer vecsize, lo, hi, llo, lhi;
-      PetscErrorCode perr = VecGetSize(*workspace.m_globaltmps[idx], &vecsize);CHKERRXX(perr);
-      perr = VecGetOwnershipRange(*workspace.m_globaltmps[idx], &llo, &lhi);CHKERRXX(perr);
-      lo = offset;
-      hi = offset + vecsize;
-      if(lo >= lhi || hi < llo)
+      Vec& disp = *workspace.m_globaltmps[idim];
+      perr = VecGetArray(disp, &ptr);CHKERRXX(perr);
+      for(integer idx=0; idx<localsize; idx++)
       {
-        continue;
+        ptr[idx] = 2*std::sin(0.3*idx + idim);
       }
-      lo = lo > llo ? lo : llo;
-      hi = hi < lhi ? hi : lhi;
-      integer localsize = hi - lo;
-      intvector idxn(localsize, lo);
-      std::iota(idxn.begin(), idxn.end(), lo);
-      floatvector data(localsize, 0);
-      perr = VecGetValues(*workspace.m_stacktmp, localsize, idxn.data(), data.data());
-      BOOST_CHECK(std::all_of(data.begin(), data.end(), [idx](floating x) -> bool{return x == floating(idx);}));
-      offset += vecsize;
+      perr = VecRestoreArray(disp, &ptr);CHKERRXX(perr);
+      disps.push_back(workspace.m_globaltmps[idim].get());
     }
+
+    for(WarpInterpolation interp : {WarpInterpolation::linear, WarpInterpolation::cubic,
+                                    WarpInterpolation::sinc})
+    {
+      workspace.m_warp_interpolation = interp;
+      Vec_unique halo = create_unique_vec();
+      perr = VecDuplicate(imgvec, halo.get());CHKERRXX(perr);
+      BOOST_REQUIRE(workspace.warp_halo(image, disps, *halo));
+
+      Mat_unique warp = build_warp_matrix(PETSC_COMM_WORLD, *image.dmda(), image.shape(),
+                                          image.ndim(), disps, interp);
+      Vec_unique assembled = create_unique_vec();
+      perr = VecDuplicate(imgvec, assembled.get());CHKERRXX(perr);
+      perr = MatMult(*warp, workspace.warp_source(image), *assembled);CHKERRXX(perr);
+
+      floating norm, diff;
+      perr = VecNorm(*assembled, NORM_2, &norm);CHKERRXX(perr);
+      perr = VecAXPY(*assembled, -1.0, *halo);CHKERRXX(perr);
+      perr = VecNorm(*assembled, NORM_2, &diff);CHKERRXX(perr);
+      BOOST_TEST(diff <= 1e-10 * norm);
+    }
+  }
+
+  BOOST_AUTO_TEST_CASE(test_prefilter_interpolates)
+  {
+    // the cubic B-spline of the prefiltered coefficients passes through the pixel values
+    const Vec& imgvec = *image.global_vec();
+    integer localsize;
+    PetscErrorCode perr = VecGetLocalSize(imgvec, &localsize);CHKERRXX(perr);
+    floating* ptr;
+    perr = VecGetArray(imgvec, &ptr);CHKERRXX(perr);
+    for(integer idx=0; idx<localsize; idx++)
+    {
+      ptr[idx] = std::cos(0.5*idx);
+    }
+    perr = VecRestoreArray(imgvec, &ptr);CHKERRXX(perr);
+    std::vector<Vec*> disps;
+    for(uinteger idim=0; idim<image.ndim(); idim++)
+    {
+      perr = VecSet(*workspace.m_globaltmps[idim], 0.);CHKERRXX(perr);
+      disps.push_back(workspace.m_globaltmps[idim].get());
+    }
+
+    workspace.m_warp_interpolation = WarpInterpolation::cubic;
+    Vec_unique sampled = create_unique_vec();
+    perr = VecDuplicate(imgvec, sampled.get());CHKERRXX(perr);
+    BOOST_REQUIRE(workspace.warp_halo(image, disps, *sampled));
+
+    floating norm, diff;
+    perr = VecNorm(imgvec, NORM_2, &norm);CHKERRXX(perr);
+    perr = VecAXPY(*sampled, -1.0, imgvec);CHKERRXX(perr);
+    perr = VecNorm(*sampled, NORM_2, &diff);CHKERRXX(perr);
+    BOOST_TEST(diff <= 1e-4 * norm);
   }
 
 BOOST_AUTO_TEST_SUITE_END()